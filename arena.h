@@ -0,0 +1,86 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHENIQS_ARENA_H
+#define PHENIQS_ARENA_H
+
+#include "include.h"
+#include "error.h"
+
+/*  Arena
+
+    Hands out blocks carved from large contiguous slabs. Blocks are never released individually,
+    every slab is released when the arena is destroyed, so the arena must outlive every object
+    placed in it. Allocation is rare, only when a record buffer grows, and is serialized with a mutex.
+*/
+const size_t ARENA_SLAB_SIZE(1 << 16);
+
+class Arena {
+    public:
+        Arena(Arena const &) = delete;
+        void operator=(Arena const &) = delete;
+        Arena(const size_t& slab_size = ARENA_SLAB_SIZE) :
+            slab_size(slab_size),
+            position(NULL),
+            remaining(0) {
+        };
+        ~Arena() {
+            for(auto slab : slab_array) {
+                free(slab);
+            }
+        };
+        void* allocate(const size_t& size, const size_t& alignment) {
+            lock_guard< mutex > arena_lock(arena_mutex);
+            size_t padding(padding_for(alignment));
+            if(padding + size > remaining) {
+                /* a block larger than a slab gets a slab of its own */
+                const size_t capacity(max(slab_size, size + alignment));
+                uint8_t* slab(static_cast< uint8_t* >(malloc(capacity)));
+                if(slab == NULL) {
+                    throw OutOfMemoryError();
+                }
+                slab_array.push_back(slab);
+                position = slab;
+                remaining = capacity;
+                padding = padding_for(alignment);
+            }
+            void* block(position + padding);
+            position += padding + size;
+            remaining -= padding + size;
+            return block;
+        };
+        template < typename T > T* allocate_array(const size_t& count) {
+            return static_cast< T* >(allocate(sizeof(T) * count, alignof(T)));
+        };
+
+    private:
+        const size_t slab_size;
+        uint8_t* position;
+        size_t remaining;
+        vector< uint8_t* > slab_array;
+        mutex arena_mutex;
+        inline size_t padding_for(const size_t& alignment) const {
+            const size_t misalignment(reinterpret_cast< uintptr_t >(position) % alignment);
+            return misalignment > 0 ? alignment - misalignment : 0;
+        };
+};
+
+#endif /* PHENIQS_ARENA_H */
@@ -44,6 +44,30 @@ static inline uint8_t aux_type2size(uint8_t type) {
             return 0;
     }
 };
+static inline void encode_tag_code(const uint16_t& code, uint8_t*& position) {
+    position[0] = static_cast< uint8_t >(code >> 8);
+    position[1] = static_cast< uint8_t >(code & 0xff);
+    position += 2;
+};
+static inline void encode_integer_tag(const uint16_t& code, const uint32_t& value, uint8_t*& position) {
+    encode_tag_code(code, position);
+    position[0] = 'i';
+    u32_to_le(value, position + 1);
+    position += 5;
+};
+static inline void encode_float_tag(const uint16_t& code, const float& value, uint8_t*& position) {
+    encode_tag_code(code, position);
+    position[0] = 'f';
+    float_to_le(value, position + 1);
+    position += 5;
+};
+static inline void encode_string_tag(const uint16_t& code, const kstring_t& value, uint8_t*& position) {
+    encode_tag_code(code, position);
+    position[0] = 'Z';
+    memcpy(position + 1, value.s, value.l);
+    position[value.l + 1] = '\0';
+    position += value.l + 2;
+};
 static inline const uint8_t* skip_aux(const uint8_t* buffer, const uint8_t* const end) {
     if(buffer < end) {
         uint8_t type(aux_type2size(*buffer));
@@ -320,47 +344,110 @@ void Auxiliary::decode(const bam1_t* bam1) {
 };
 void Auxiliary::encode(bam1_t* bam1) const {
     if(bam1 != NULL) {
+        /*  The size of every tag is computed first so the record data grows at most once
+            and the tags are then written in place one after the other */
+        const int64_t l_data(static_cast< int64_t >(bam1->l_data) + static_cast< int64_t >(encoded_size()));
+        if(l_data <= numeric_limits< int32_t >::max()) {
+            if(bam1->m_data < l_data) {
+                bam1->m_data = static_cast< uint32_t >(l_data);
+                kroundup32(bam1->m_data);
+                if((bam1->data = static_cast< uint8_t* >(realloc(bam1->data, bam1->m_data))) == NULL) {
+                    throw OutOfMemoryError();
+                }
+            }
+            uint8_t* position(bam1->data + bam1->l_data);
 
-        /*  TC and FI are not mandatory when there are 1 or 2 segments in the read
-            In that case the structure can be deduced from the flags alone */
-        if(TC > 2) {
-            if(FI > 0)       { bam_aux_append(bam1, "FI", 'i', sizeof(uint32_t),             reinterpret_cast< const uint8_t* >(&FI));  }
-            if(TC > 0)       { bam_aux_append(bam1, "TC", 'i', sizeof(uint32_t),             reinterpret_cast< const uint8_t* >(&TC));  }
-        }
-        if(ks_not_empty(FS)) { bam_aux_append(bam1, "FS", 'Z', static_cast< int >(FS.l + 1), reinterpret_cast< const uint8_t* >(FS.s)); }
-        if(ks_not_empty(RG)) { bam_aux_append(bam1, "RG", 'Z', static_cast< int >(RG.l + 1), reinterpret_cast< const uint8_t* >(RG.s)); }
-        if(ks_not_empty(PU)) { bam_aux_append(bam1, "PU", 'Z', static_cast< int >(PU.l + 1), reinterpret_cast< const uint8_t* >(PU.s)); }
-        if(ks_not_empty(LB)) { bam_aux_append(bam1, "LB", 'Z', static_cast< int >(LB.l + 1), reinterpret_cast< const uint8_t* >(LB.s)); }
-        if(ks_not_empty(PG)) { bam_aux_append(bam1, "PG", 'Z', static_cast< int >(PG.l + 1), reinterpret_cast< const uint8_t* >(PG.s)); }
-        if(ks_not_empty(CO)) { bam_aux_append(bam1, "CO", 'Z', static_cast< int >(CO.l + 1), reinterpret_cast< const uint8_t* >(CO.s)); }
-
-        if(ks_not_empty(BC)) { bam_aux_append(bam1, "BC", 'Z', static_cast< int >(BC.l + 1), reinterpret_cast< const uint8_t* >(BC.s)); }
-        if(ks_not_empty(QT)) { bam_aux_append(bam1, "QT", 'Z', static_cast< int >(QT.l + 1), reinterpret_cast< const uint8_t* >(QT.s)); }
-        if(XB > 0)           { bam_aux_append(bam1, "XB", 'f', sizeof(float),                reinterpret_cast< const uint8_t* >(&XB));  }
-
-        if(ks_not_empty(RX)) { bam_aux_append(bam1, "RX", 'Z', static_cast< int >(RX.l + 1), reinterpret_cast< const uint8_t* >(RX.s)); }
-        if(ks_not_empty(QX)) { bam_aux_append(bam1, "QX", 'Z', static_cast< int >(QX.l + 1), reinterpret_cast< const uint8_t* >(QX.s)); }
-        if(ks_not_empty(OX)) { bam_aux_append(bam1, "OX", 'Z', static_cast< int >(OX.l + 1), reinterpret_cast< const uint8_t* >(OX.s)); }
-        if(ks_not_empty(BZ)) { bam_aux_append(bam1, "BZ", 'Z', static_cast< int >(BZ.l + 1), reinterpret_cast< const uint8_t* >(BZ.s)); }
-        if(ks_not_empty(MI)) { bam_aux_append(bam1, "MI", 'Z', static_cast< int >(MI.l + 1), reinterpret_cast< const uint8_t* >(MI.s)); }
-        if(XM > 0)           { bam_aux_append(bam1, "XM", 'f', sizeof(float),                reinterpret_cast< const uint8_t* >(&XM));  }
-
-        if(ks_not_empty(CB)) { bam_aux_append(bam1, "CB", 'Z', static_cast< int >(CB.l + 1), reinterpret_cast< const uint8_t* >(CB.s)); }
-        if(ks_not_empty(CR)) { bam_aux_append(bam1, "CR", 'Z', static_cast< int >(CR.l + 1), reinterpret_cast< const uint8_t* >(CR.s)); }
-        if(ks_not_empty(CY)) { bam_aux_append(bam1, "CY", 'Z', static_cast< int >(CY.l + 1), reinterpret_cast< const uint8_t* >(CY.s)); }
-        if(XC > 0)           { bam_aux_append(bam1, "XC", 'f', sizeof(float),                reinterpret_cast< const uint8_t* >(&XC));  }
-        if(XO > 0)           { bam_aux_append(bam1, "XO", 'f', sizeof(float),                reinterpret_cast< const uint8_t* >(&XO));  }
-
-        if(EE > 0)           { bam_aux_append(bam1, "EE", 'f', sizeof(float),                reinterpret_cast< const uint8_t* >(&EE));  }
-
-        #if defined(PHENIQS_EXTENDED_SAM_TAG)
-        for(auto& record : extended) {
-            if(!record.second.empty()) {
-                bam_aux_append(bam1, reinterpret_cast< const char* >(&record.first), record.second.type(), record.second.length, record.second.data);
+            /*  TC and FI are not mandatory when there are 1 or 2 segments in the read
+                In that case the structure can be deduced from the flags alone */
+            if(TC > 2) {
+                if(FI > 0)       { encode_integer_tag(uint16_t(HtsTagCode::FI), FI, position); }
+                if(TC > 0)       { encode_integer_tag(uint16_t(HtsTagCode::TC), TC, position); }
+            }
+            if(ks_not_empty(FS)) { encode_string_tag(uint16_t(HtsTagCode::FS), FS, position); }
+            if(ks_not_empty(RG)) { encode_string_tag(uint16_t(HtsTagCode::RG), RG, position); }
+            if(ks_not_empty(PU)) { encode_string_tag(uint16_t(HtsTagCode::PU), PU, position); }
+            if(ks_not_empty(LB)) { encode_string_tag(uint16_t(HtsTagCode::LB), LB, position); }
+            if(ks_not_empty(PG)) { encode_string_tag(uint16_t(HtsTagCode::PG), PG, position); }
+            if(ks_not_empty(CO)) { encode_string_tag(uint16_t(HtsTagCode::CO), CO, position); }
+
+            if(ks_not_empty(BC)) { encode_string_tag(uint16_t(HtsTagCode::BC), BC, position); }
+            if(ks_not_empty(QT)) { encode_string_tag(uint16_t(HtsTagCode::QT), QT, position); }
+            if(XB > 0)           { encode_float_tag(uint16_t(HtsTagCode::XB), XB, position);   }
+
+            if(ks_not_empty(RX)) { encode_string_tag(uint16_t(HtsTagCode::RX), RX, position); }
+            if(ks_not_empty(QX)) { encode_string_tag(uint16_t(HtsTagCode::QX), QX, position); }
+            if(ks_not_empty(OX)) { encode_string_tag(uint16_t(HtsTagCode::OX), OX, position); }
+            if(ks_not_empty(BZ)) { encode_string_tag(uint16_t(HtsTagCode::BZ), BZ, position); }
+            if(ks_not_empty(MI)) { encode_string_tag(uint16_t(HtsTagCode::MI), MI, position); }
+            if(XM > 0)           { encode_float_tag(uint16_t(HtsTagCode::XM), XM, position);   }
+
+            if(ks_not_empty(CB)) { encode_string_tag(uint16_t(HtsTagCode::CB), CB, position); }
+            if(ks_not_empty(CR)) { encode_string_tag(uint16_t(HtsTagCode::CR), CR, position); }
+            if(ks_not_empty(CY)) { encode_string_tag(uint16_t(HtsTagCode::CY), CY, position); }
+            if(XC > 0)           { encode_float_tag(uint16_t(HtsTagCode::XC), XC, position);   }
+            if(XO > 0)           { encode_float_tag(uint16_t(HtsTagCode::XO), XO, position);   }
+
+            if(EE > 0)           { encode_float_tag(uint16_t(HtsTagCode::EE), EE, position);   }
+
+            #if defined(PHENIQS_EXTENDED_SAM_TAG)
+            /* the value of an extended tag is kept as decoded, starting with the type character */
+            for(auto& record : extended) {
+                if(!record.second.empty()) {
+                    encode_tag_code(record.first, position);
+                    memcpy(position, record.second.data, record.second.length);
+                    position += record.second.length;
+                }
             }
+            #endif
+
+            bam1->l_data = static_cast< int32_t >(l_data);
+
+        } else { throw OverflowError("BAM record must not exceed " + to_string(numeric_limits< int32_t >::max()) + " bytes"); }
+    }
+};
+size_t Auxiliary::encoded_size() const {
+    /*  every tag is a 2 byte code and a type character followed by the value,
+        a string value is \0 terminated and integer and float values are 4 bytes */
+    size_t size(0);
+    if(TC > 2) {
+        if(FI > 0)       { size += 7;        }
+        if(TC > 0)       { size += 7;        }
+    }
+    if(ks_not_empty(FS)) { size += FS.l + 4; }
+    if(ks_not_empty(RG)) { size += RG.l + 4; }
+    if(ks_not_empty(PU)) { size += PU.l + 4; }
+    if(ks_not_empty(LB)) { size += LB.l + 4; }
+    if(ks_not_empty(PG)) { size += PG.l + 4; }
+    if(ks_not_empty(CO)) { size += CO.l + 4; }
+
+    if(ks_not_empty(BC)) { size += BC.l + 4; }
+    if(ks_not_empty(QT)) { size += QT.l + 4; }
+    if(XB > 0)           { size += 7;        }
+
+    if(ks_not_empty(RX)) { size += RX.l + 4; }
+    if(ks_not_empty(QX)) { size += QX.l + 4; }
+    if(ks_not_empty(OX)) { size += OX.l + 4; }
+    if(ks_not_empty(BZ)) { size += BZ.l + 4; }
+    if(ks_not_empty(MI)) { size += MI.l + 4; }
+    if(XM > 0)           { size += 7;        }
+
+    if(ks_not_empty(CB)) { size += CB.l + 4; }
+    if(ks_not_empty(CR)) { size += CR.l + 4; }
+    if(ks_not_empty(CY)) { size += CY.l + 4; }
+    if(XC > 0)           { size += 7;        }
+    if(XO > 0)           { size += 7;        }
+
+    if(EE > 0)           { size += 7;        }
+
+    #if defined(PHENIQS_EXTENDED_SAM_TAG)
+    for(auto& record : extended) {
+        if(!record.second.empty()) {
+            size += record.second.length + 2;
         }
-        #endif
     }
+    #endif
+
+    return size;
 };
 ostream& operator<<(ostream& o, const Auxiliary& auxiliary) {
     if(auxiliary.FI > 0)           o << "FI : " << auxiliary.FI   << endl;
@@ -245,6 +245,7 @@ class Auxiliary {
         ~Auxiliary();
         void decode(const bam1_t* bam1);
         void encode(bam1_t* bam1) const;
+        size_t encoded_size() const;
 
         inline void set_RG(const string& rg) {
             if(!rg.empty()) ks_put_string(rg, RG);
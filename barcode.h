@@ -43,17 +43,6 @@ class Barcode : public SequenceArray< Sequence >, public AccumulatingOption {
         inline const bool is_unclassified() const {
             return index == 0;
         };
-        operator string() const {
-            /*  NOTICE this is in BAM encoding not iupac and will not look as expected when printed
-                Used by MDD for exact match */
-            string key;
-            for(const auto& segment : segment_array) {
-                for(int32_t i(0); i < segment.length; ++i) {
-                    key.push_back(segment.code[i]);
-                }
-            }
-            return key;
-        };
         inline void accurate_decoding_probability(const Observation& observation, double& probability) const {
             double sigma_q(0);
             for(size_t i(0); i < segment_array.size(); ++i) {
@@ -75,6 +75,11 @@ template < class T > class Classifier : public AccumulatingSelector {
 
             decoded = &unclassified;
         };
+        virtual inline void prepare(const vector< Read* >& batch) {
+        };
+        inline uint64_t unclassified_count() const {
+            return unclassified.count;
+        };
         virtual inline void classify(const Read& input, Read& output) {
             ++(decoded->count);
             if(!output.qcfail()) {
@@ -32,14 +32,34 @@ template < class T > class Decoder : public Classifier< T > {
         const int32_t nucleotide_cardinality;
         const uint8_t high_quality_threshold;
         const int32_t high_quality_distance_threshold;
-        Observation observation;
+        ObservationBatch observation_batch;
+        ObservationView batch_observation;
+        Observation unprepared_observation;
+        const Observation* observation_row;
         int32_t edit_distance;
         int32_t high_quality_edit_distance;
-
+        inline const Observation& observation() const {
+            return *observation_row;
+        };
+        inline void load_observation(const Read& input) {
+            /* score a prepared read in place from its row in the batch, fall back to the rule for unprepared reads */
+            if(input.observation_index >= 0) {
+                const size_t index(static_cast< size_t >(input.observation_index));
+                if(index >= observation_batch.size() || observation_batch.source(index) != &input) {
+                    throw InternalError("read was not prepared in row " + to_string(index) + " of the observation batch");
+                }
+                batch_observation.bind(observation_batch, index);
+                observation_row = &batch_observation;
+            } else {
+                unprepared_observation.clear();
+                rule.apply(input, unprepared_observation);
+                observation_row = &unprepared_observation;
+            }
+        };
 
     public:
         inline const int32_t segment_cardinality() const {
-            return static_cast< int32_t >(observation.segment_cardinality());
+            return static_cast< int32_t >(observation_batch.segment_cardinality());
         };
         Decoder(const Value& ontology) try :
             Classifier< T >(ontology),
@@ -47,7 +67,10 @@ template < class T > class Decoder : public Classifier< T > {
             nucleotide_cardinality(decode_value_by_key< int32_t >("nucleotide cardinality", ontology)),
             high_quality_threshold(decode_value_by_key< uint8_t >("high quality threshold", ontology)),
             high_quality_distance_threshold(decode_value_by_key< int32_t >("high quality distance threshold", ontology)),
-            observation(decode_value_by_key< int32_t >("segment cardinality", ontology)),
+            observation_batch(decode_value_by_key< int32_t >("segment cardinality", ontology)),
+            batch_observation(decode_value_by_key< int32_t >("segment cardinality", ontology)),
+            unprepared_observation(decode_value_by_key< int32_t >("segment cardinality", ontology)),
+            observation_row(&unprepared_observation),
             edit_distance(0),
             high_quality_edit_distance(0) {
 
@@ -61,10 +84,16 @@ template < class T > class Decoder : public Classifier< T > {
             nucleotide_cardinality(other.nucleotide_cardinality),
             high_quality_threshold(other.high_quality_threshold),
             high_quality_distance_threshold(other.high_quality_distance_threshold),
-            observation(other.observation.segment_cardinality()),
+            observation_batch(other.segment_cardinality()),
+            batch_observation(other.segment_cardinality()),
+            unprepared_observation(other.segment_cardinality()),
+            observation_row(&unprepared_observation),
             edit_distance(0),
             high_quality_edit_distance(0) {
         };
+        inline void prepare(const vector< Read* >& batch) override {
+            rule.apply(batch, observation_batch);
+        };
         inline void classify(const Read& input, Read& output) override {
             if(this->decoded->is_classified() && edit_distance) {
                 this->decoded->accumulated_distance += static_cast< uint64_t >(edit_distance);
@@ -24,8 +24,9 @@
 template<> int CyclicBuffer< FastqRecord >::increase_capacity(const int& capacity) {
     if(capacity > _capacity) {
         cache.resize(capacity);
+        FastqRecord* block(arena.allocate_array< FastqRecord >(capacity - _capacity));
         for(int i(_capacity); i < capacity; ++i) {
-            cache[i] = new FastqRecord();
+            cache[i] = new(block + (i - _capacity)) FastqRecord();
         }
         if(_vacant < 0) {
             _vacant = _capacity;
@@ -36,6 +37,6 @@ template<> int CyclicBuffer< FastqRecord >::increase_capacity(const int& capacit
 };
 template<> CyclicBuffer< FastqRecord >::~CyclicBuffer() {
     for(auto record : cache) {
-        delete record;
+        record->~FastqRecord();
     }
 };
@@ -24,8 +24,17 @@
 
 #include "include.h"
 #include "feed.h"
+#include "simd.h"
 
-KSEQ_INIT(BGZF*, bgzf_read)
+/*  Size of a read from the decompressed input stream.
+    Records are located in the stream by the feed thread and copied as raw text,
+    they are parsed on the decoding thread that pulls them. */
+const int32_t FASTQ_STREAM_READ_SIZE(1 << 20);
+
+/*  BGZF blocks are inflated by the htslib thread pool but a plain gzip stream can only be
+    inflated sequentially. A gzip stream is instead inflated ahead on a dedicated thread into
+    a short queue of blocks so inflating overlaps locating records on the feed thread. */
+const int32_t FASTQ_INFLATE_AHEAD_DEPTH(4);
 
 class FastqRecord {
     public:
@@ -35,15 +44,18 @@ class FastqRecord {
         kstring_t quality;
         kstring_t name;
         kstring_t comment;
+        kstring_t text;
         FastqRecord() :
             sequence({ 0, 0, NULL }),
             quality({ 0, 0, NULL }),
             name({ 0, 0, NULL }),
-            comment({ 0, 0, NULL }) {
+            comment({ 0, 0, NULL }),
+            text({ 0, 0, NULL }) {
             ks_terminate(sequence);
             ks_terminate(quality);
             ks_terminate(name);
             ks_terminate(comment);
+            ks_terminate(text);
             clear();
         };
         ~FastqRecord() {
@@ -51,30 +63,7 @@ class FastqRecord {
             ks_free(quality);
             ks_free(name);
             ks_free(comment);
-        };
-        inline void decode(const kseq_t* kseq, const uint8_t phred_offset) {
-            // read a kseq record and populate the FastqRecord
-            clear();
-
-            // copy from kseq_t to record
-            ks_put_string(kseq->name, name);
-            ks_put_string(kseq->comment, comment);
-
-            // decode sequence
-            ks_increase_to_size(sequence, kseq->seq.l + 2);
-            for(size_t i(0); i < kseq->seq.l; ++i) {
-                sequence.s[i] = AsciiToAmbiguousBam[static_cast< uint8_t >(kseq->seq.s[i])];
-            }
-            sequence.l = kseq->seq.l;
-            sequence.s[sequence.l] = '\0';
-
-            // decode quality
-            ks_increase_to_size(quality, kseq->qual.l + 2);
-            for(size_t i(0); i < kseq->qual.l; ++i) {
-                quality.s[i] = kseq->qual.s[i] - phred_offset;
-            }
-            quality.l = kseq->qual.l;
-            quality.s[quality.l] = '\0';
+            ks_free(text);
         };
         inline void decode(const Segment& segment) {
             clear();
@@ -85,12 +74,55 @@ class FastqRecord {
             ks_put_string(segment.name.s, segment.name.l, name);
             decode_comment(segment);
         };
-        inline void encode(Segment& segment) const {
+        inline void encode(Segment& segment, const uint8_t phred_offset) const {
+            /*  parse the raw record text located by the feed thread straight into the segment.
+                BAM encoded nucleotides and offset corrected quality scores are written directly
+                to the segment without going through the sequence and quality of the record.
+                Like kseq the name ends at the first white space, the sequence and quality
+                may be wrapped over several lines and a trailing carriage return is ignored. */
+            const char* position(text.s);
+            const char* end(text.s + text.l);
+            const char* line_end(next_line_end(position, end));
+
+            // decode identifier
+            ++position;
+            const char* name_end(position);
+            while(name_end < line_end && !isspace(*name_end)) {
+                ++name_end;
+            }
+            ks_put_string(position, name_end - position, segment.name);
+            if(name_end < line_end && *name_end != '\r') {
+                position = name_end + 1;
+                ks_put_string(position, trim_line_end(position, line_end) - position, segment.auxiliary.CO);
+            }
+            position = line_end + 1;
+
+            // decode sequence
+            int32_t length(0);
+            segment.increase_to_size(static_cast< int32_t >(text.l));
+            while(position < end && *position != '+') {
+                line_end = next_line_end(position, end);
+                const char* sequence_end(trim_line_end(position, line_end));
+                ascii_to_bam(position, segment.code + length, sequence_end - position);
+                length += static_cast< int32_t >(sequence_end - position);
+                position = line_end + 1;
+            }
+
+            // skip separator
+            position = next_line_end(position, end) + 1;
+
+            // decode quality
+            uint8_t* quality_position(segment.quality);
+            while(position < end) {
+                line_end = next_line_end(position, end);
+                const char* quality_end(trim_line_end(position, line_end));
+                subtract_phred_offset(position, quality_position, quality_end - position, phred_offset);
+                quality_position += quality_end - position;
+                position = line_end + 1;
+            }
+            segment.length = length;
+            segment.terminate();
 
-            // write the FastqRecord to Segment
-            segment.fill(reinterpret_cast< uint8_t* >(sequence.s), reinterpret_cast< uint8_t* >(quality.s), static_cast< int32_t >(sequence.l));
-            ks_put_string(name, segment.name);
-            ks_put_string(comment, segment.auxiliary.CO);
             segment.auxiliary.FI = 0;
             segment.set_qcfail(false);
 
@@ -151,9 +183,7 @@ class FastqRecord {
 
             // encode sequence
             ks_increase_by_size(buffer, sequence.l + 2);
-            for(size_t i(0); i < sequence.l; ++i) {
-                buffer.s[buffer.l + i] = BamToAmbiguousAscii[static_cast< uint8_t >(sequence.s[i])];
-            }
+            bam_to_ascii(reinterpret_cast< const uint8_t* >(sequence.s), buffer.s + buffer.l, sequence.l);
             buffer.l += sequence.l;
             ks_put_character(LINE_BREAK, buffer);
 
@@ -163,14 +193,19 @@ class FastqRecord {
 
             // encode quality
             ks_increase_by_size(buffer, quality.l + 2);
-            for(size_t i(0); i < quality.l; ++i) {
-                buffer.s[buffer.l + i] = quality.s[i] + phred_offset;
-            }
+            add_phred_offset(reinterpret_cast< const uint8_t* >(quality.s), buffer.s + buffer.l, quality.l, phred_offset);
             buffer.l += quality.l;
             ks_put_character(LINE_BREAK, buffer);
         };
 
     private:
+        static inline const char* next_line_end(const char* position, const char* end) {
+            const char* line_end(static_cast< const char* >(memchr(position, LINE_BREAK, end - position)));
+            return line_end != NULL ? line_end : end;
+        };
+        static inline const char* trim_line_end(const char* position, const char* line_end) {
+            return (line_end > position && *(line_end - 1) == '\r') ? line_end - 1 : line_end;
+        };
         inline void clear() {
             ks_clear(sequence);
             ks_clear(quality);
@@ -338,7 +373,24 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
     public:
         FastqFeed(const FeedProxy& proxy) :
             BufferedFeed< FastqRecord >(proxy),
-            bgzf_file(NULL) {
+            bgzf_file(NULL),
+            stream({ 0, 0, NULL }),
+            stream_position(0),
+            end_of_stream(false),
+            inflated_block(FASTQ_INFLATE_AHEAD_DEPTH, { 0, 0, NULL }),
+            inflated_next(0),
+            inflated_size(0),
+            inflate_end(false),
+            inflate_error(false),
+            inflate_stop(false) {
+            ks_terminate(stream);
+        };
+        ~FastqFeed() override {
+            stop_inflating();
+            for(auto& block : inflated_block) {
+                ks_free(block);
+            }
+            ks_free(stream);
         };
         void open() override {
             if(!opened()) {
@@ -357,8 +409,20 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
                         mode.push_back('r');
                         bgzf_file = bgzf_hopen(hfile, mode.c_str());
                         if(bgzf_file != NULL) {
-                            kseq = kseq_init(bgzf_file);
-                            // bgzf_thread_pool(bgzf_file, thread_pool->pool, thread_pool->qsize);
+                            switch(bgzf_compression(bgzf_file)) {
+                                case 1: {
+                                    /* plain gzip */
+                                    inflate_thread = thread(&FastqFeed::inflate, this);
+                                    break;
+                                };
+                                case 2: {
+                                    /* BGZF */
+                                    bgzf_thread_pool(bgzf_file, thread_pool->pool, thread_pool->qsize);
+                                    break;
+                                };
+                                default:
+                                    break;
+                            }
                         } else {
                             throw IOError("failed to open " + string(url.path()) + " for reading");
                         }
@@ -389,7 +453,6 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
                         bgzf_file = bgzf_hopen(hfile, mode.c_str());
 
                         if(bgzf_file != NULL) {
-                            kseq = kseq_init(bgzf_file);
                             bgzf_thread_pool(bgzf_file, thread_pool->pool, thread_pool->qsize);
                         } else {
                             throw IOError("failed to open " + string(url.path()) + " for writing");
@@ -404,11 +467,9 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
         };
         void close() override {
             if(opened()) {
+                stop_inflating();
                 bgzf_close(bgzf_file);
                 bgzf_file = NULL;
-
-                kseq_destroy(kseq);
-                kseq = NULL;
             }
         };
         inline bool opened() override {
@@ -417,27 +478,230 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
 
     protected:
         BGZF* bgzf_file;
-        kseq_t* kseq;
+        kstring_t stream;
+        size_t stream_position;
+        bool end_of_stream;
         inline void encode(FastqRecord* record, const Segment& segment) const override {
             record->decode(segment);
         };
+        inline bool is_serializable() const override {
+            return direction == IoDirection::OUT;
+        };
+        inline void serialize(const FastqRecord* record, kstring_t& buffer, kstring_t& scratch) const override {
+            record->encode(buffer, phred_offset);
+        };
+        inline void flush_serialized(const kstring_t& buffer) override {
+            if(bgzf_write(bgzf_file, buffer.s, buffer.l) < 0) {
+                throw IOError("error writing to " + string(url.path()));
+            }
+        };
         inline void decode(const FastqRecord* record, Segment& segment) override {
-            record->encode(segment);
-        };
-        inline void replenish_buffer() override {
-            while(opened() && buffer->is_not_full()) {
-             /* >=0  length of the sequence (normal)
-                -1   end-of-file
-                -2   truncated quality string */
-                if(kseq_read(kseq) < 0) {
+            /* the raw record is parsed by the decoding thread that pulls it */
+            record->encode(segment, phred_offset);
+        };
+        inline void replenish_buffer(CyclicBuffer< FastqRecord >* target) override {
+            while(opened() && target->is_not_full()) {
+                if(read_record(target->vacant()->text)) {
+                    target->increment();
+                } else {
                     close();
                     break;
+                }
+            }
+        };
+        inline bool read_record(kstring_t& text) {
+            /*  copy the raw text of the next record in the stream to text,
+                returns false when the stream is exhausted */
+            size_t length;
+            skip_empty_lines();
+            while((length = locate_record()) == 0) {
+                if(end_of_stream) {
+                    if(stream_position < stream.l) {
+                        throw IOError("truncated FASTQ record in " + string(url.path()));
+                    }
+                    return false;
+                }
+                replenish_stream();
+                skip_empty_lines();
+            }
+            ks_clear(text);
+            ks_put_string(stream.s + stream_position, length, text);
+            stream_position += length;
+            return true;
+        };
+        inline size_t locate_record() const {
+            /*  length of the complete record at the stream position or 0 if more of the stream must be read.
+                The feed thread only looks for the record boundary, lines are split by FastqRecord::encode
+                on the decoding thread. A quality line may start with @ so a line break followed by @ is not
+                enough to end a record. Most records are four lines and end at the fourth line break when the
+                third line is the separator and the quality is as long as the sequence. */
+            const char* begin(stream.s + stream_position);
+            const char* end(stream.s + stream.l);
+            const char* line_end[4];
+            const char* position(begin);
+
+            if(position == end) {
+                return 0;
+            }
+            if(*position != '@') {
+                throw IOError("malformed FASTQ record in " + string(url.path()));
+            }
+            for(int32_t i(0); i < 4; ++i) {
+                if((line_end[i] = static_cast< const char* >(memchr(position, LINE_BREAK, end - position))) == NULL) {
+                    /* a record is at least four lines unless it is the last one in the stream */
+                    return end_of_stream ? locate_wrapped_record() : 0;
+                }
+                position = line_end[i] + 1;
+            }
+            if(*(line_end[0] + 1) != '+' && *(line_end[1] + 1) == '+' && line_end[1] - line_end[0] == line_end[3] - line_end[2]) {
+                return position - begin;
+            }
+            return locate_wrapped_record();
+        };
+        inline size_t locate_wrapped_record() const {
+            /*  sequence and quality lines are counted so wrapped records are delimited the same way kseq reads them */
+            const char* begin(stream.s + stream_position);
+            const char* end(stream.s + stream.l);
+            const char* position(begin);
+            const char* line_begin;
+            size_t sequence_length(0);
+            size_t quality_length(0);
+
+            /* identifier */
+            if(!next_line(position, end)) return 0;
+
+            /* sequence lines up to the separator */
+            while(position == end || *position != '+') {
+                if(position == end) return 0;
+                line_begin = position;
+                if(!next_line(position, end)) return 0;
+                sequence_length += line_length(line_begin, position);
+            }
+
+            /* separator */
+            if(!next_line(position, end)) return 0;
+
+            /* quality lines until they cover the sequence */
+            do {
+                if(position == end) {
+                    /* an empty last record may end without a quality line */
+                    if(end_of_stream && sequence_length == 0) break;
+                    return 0;
+                }
+                line_begin = position;
+                if(!next_line(position, end)) return 0;
+                quality_length += line_length(line_begin, position);
+            } while(quality_length < sequence_length);
+
+            if(quality_length != sequence_length) {
+                throw IOError("FASTQ quality and sequence length differ in " + string(url.path()));
+            }
+            return position - begin;
+        };
+        inline void skip_empty_lines() {
+            while(stream_position < stream.l && (stream.s[stream_position] == LINE_BREAK || stream.s[stream_position] == '\r')) {
+                ++stream_position;
+            }
+        };
+        inline bool next_line(const char*& position, const char* end) const {
+            /*  advance position past the next line break,
+                the last line in the stream does not need one */
+            const char* line_end(static_cast< const char* >(memchr(position, LINE_BREAK, end - position)));
+            if(line_end != NULL) {
+                position = line_end + 1;
+                return true;
+            } else if(end_of_stream && position < end) {
+                position = end;
+                return true;
+            }
+            return false;
+        };
+        static inline size_t line_length(const char* begin, const char* end) {
+            if(end > begin && *(end - 1) == LINE_BREAK) --end;
+            if(end > begin && *(end - 1) == '\r') --end;
+            return end - begin;
+        };
+        inline void replenish_stream() {
+            /* move the incomplete record to the front of the stream and read more */
+            if(stream_position > 0) {
+                memmove(stream.s, stream.s + stream_position, stream.l - stream_position);
+                stream.l -= stream_position;
+                stream_position = 0;
+            }
+            ks_increase_by_size(stream, FASTQ_STREAM_READ_SIZE + 2);
+            ssize_t length;
+            if(inflate_thread.joinable()) {
+                length = read_inflated(stream.s + stream.l);
+            } else {
+                length = bgzf_read(bgzf_file, stream.s + stream.l, FASTQ_STREAM_READ_SIZE);
+            }
+            if(length < 0) {
+                throw IOError("error reading from " + string(url.path()));
+            } else if(length == 0) {
+                end_of_stream = true;
+            }
+            stream.l += length;
+        };
+        void inflate() {
+            /*  inflate the gzip stream into the queue of inflated blocks until the
+                stream ends, an error occurs or the feed is closed */
+            while(true) {
+                int32_t vacant;
+                {
+                    unique_lock< mutex > inflate_lock(inflate_mutex);
+                    inflated_consumed.wait(inflate_lock, [this]() { return inflate_stop || inflated_size < FASTQ_INFLATE_AHEAD_DEPTH; });
+                    if(inflate_stop) {
+                        return;
+                    }
+                    vacant = (inflated_next + inflated_size) % FASTQ_INFLATE_AHEAD_DEPTH;
+                }
+
+                /* the consumer does not touch a vacant block so it is inflated without holding the lock */
+                kstring_t& block(inflated_block[vacant]);
+                ks_clear(block);
+                ks_increase_to_size(block, FASTQ_STREAM_READ_SIZE + 2);
+                ssize_t length(bgzf_read(bgzf_file, block.s, FASTQ_STREAM_READ_SIZE));
+
+                lock_guard< mutex > inflate_lock(inflate_mutex);
+                if(length > 0) {
+                    block.l = length;
+                    ++inflated_size;
                 } else {
-                    buffer->vacant()->decode(kseq, phred_offset);
-                    buffer->increment();
+                    inflate_error = length < 0;
+                    inflate_end = true;
+                }
+                inflated_available.notify_one();
+                if(inflate_end) {
+                    return;
                 }
             }
         };
+        inline ssize_t read_inflated(char* buffer) {
+            /*  copy the next inflated block to buffer, that must have room for FASTQ_STREAM_READ_SIZE bytes,
+                returns the number of bytes copied, 0 at the end of the stream or -1 on error */
+            unique_lock< mutex > inflate_lock(inflate_mutex);
+            inflated_available.wait(inflate_lock, [this]() { return inflated_size > 0 || inflate_end; });
+            if(inflated_size > 0) {
+                const kstring_t& block(inflated_block[inflated_next]);
+                memcpy(buffer, block.s, block.l);
+                ssize_t length(block.l);
+                inflated_next = (inflated_next + 1) % FASTQ_INFLATE_AHEAD_DEPTH;
+                --inflated_size;
+                inflated_consumed.notify_one();
+                return length;
+            }
+            return inflate_error ? -1 : 0;
+        };
+        void stop_inflating() {
+            if(inflate_thread.joinable()) {
+                {
+                    lock_guard< mutex > inflate_lock(inflate_mutex);
+                    inflate_stop = true;
+                    inflated_consumed.notify_one();
+                }
+                inflate_thread.join();
+            }
+        };
         inline void flush_buffer() override {
             /*  encode all fastq records in the buffer to
                 a string buffer and write them together to the stream */
@@ -453,5 +717,17 @@ class FastqFeed : public BufferedFeed< FastqRecord > {
                 }
             }
         };
+
+    private:
+        vector< kstring_t > inflated_block;
+        int32_t inflated_next;
+        int32_t inflated_size;
+        bool inflate_end;
+        bool inflate_error;
+        bool inflate_stop;
+        thread inflate_thread;
+        mutex inflate_mutex;
+        condition_variable inflated_available;
+        condition_variable inflated_consumed;
 };
 #endif /* PHENIQS_FASTQ_H */
@@ -21,6 +21,11 @@
 
 #include "feed.h"
 
+thread_local uint64_t idle_wait_microseconds(0);
+#if defined(PHENIQS_STAGE_PROFILE)
+thread_local uint64_t wait_cycles(0);
+#endif
+
 Value encode_value(const Feed& value, Document& document) {
     Value element(kObjectType);
     encode_key_value("index", value.index, element, document);
@@ -23,6 +23,8 @@
 #define PHENIQS_FEED_H
 
 #include "include.h"
+#include "arena.h"
+#include "profile.h"
 #include "proxy.h"
 #include "read.h"
 
@@ -37,6 +39,47 @@ inline int align_to_resolution(const int& capacity, const int& resolution) {
     return aligned;
 };
 
+/*  Back off while waiting on another thread without taking a lock.
+    Yield for the first attempts and sleep for a short while after that
+    so a thread waiting on slow IO does not keep a core busy. */
+const int32_t BACK_OFF_YIELD_ATTEMPTS(64);
+const int32_t BACK_OFF_SLEEP_MICROSECONDS(50);
+
+inline void back_off(int32_t& attempt) {
+    if(attempt < BACK_OFF_YIELD_ATTEMPTS) {
+        ++attempt;
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(BACK_OFF_SLEEP_MICROSECONDS));
+    }
+};
+
+class Feed;
+
+/*  Output stage
+
+    A thread local buffer of records encoded for a single output feed. A decoding thread encodes
+    segments into its stage without holding any lock and hands every staged record to the feed in
+    one critical section, so the push lock of the feed is taken once per batch rather than once per read.
+*/
+const int32_t OUTPUT_STAGE_CAPACITY(64); /* reads staged for a feed before the stages are handed over */
+
+class OutputStage {
+    public:
+        OutputStage(OutputStage const &) = delete;
+        void operator=(OutputStage const &) = delete;
+        Feed& feed;
+        OutputStage(Feed& feed) :
+            feed(feed) {
+        };
+        virtual ~OutputStage() {
+        };
+        virtual void push(const Segment& segment) = 0;
+        virtual void serialize() = 0;
+        virtual bool is_empty() const = 0;
+        virtual bool is_full() const = 0;
+};
+
 /* IO feed */
 class Feed {
     public:
@@ -45,14 +88,24 @@ class Feed {
         const IoDirection direction;
         const uint8_t phred_offset;
         const Platform platform;
+        #if defined(PHENIQS_STAGE_PROFILE)
+        /* cycles decoding threads waited on the feed to publish input or accept output */
+        atomic< uint64_t > pull_wait_cycles;
+        atomic< uint64_t > push_wait_cycles;
+        #endif
         Feed(const FeedProxy& proxy) :
             index(proxy.index),
             url(proxy.url),
             direction(proxy.direction),
             phred_offset(proxy.phred_offset),
             platform(proxy.platform),
+            #if defined(PHENIQS_STAGE_PROFILE)
+            pull_wait_cycles(0),
+            push_wait_cycles(0),
+            #endif
             _capacity(proxy.capacity),
             _resolution(proxy.resolution),
+            _batch_size(proxy.capacity),
             exhausted(false),
             initiated(false),
             hfile(proxy.hfile),
@@ -66,13 +119,19 @@ class Feed {
         const inline int& resolution() const {
             return _resolution;
         };
+        const inline int& batch_size() const {
+            return _batch_size;
+        };
         virtual void join() = 0;
         virtual void start() = 0;
         virtual void stop() = 0;
         virtual void open() = 0;
         virtual void close() = 0;
-        virtual bool pull(Segment& segment) = 0;
+        virtual bool pull(const int64_t& ordinal, const int32_t& record, Segment& segment) = 0;
+        virtual void release(const int64_t& first, const int64_t& end) = 0;
         virtual void push(const Segment& segment) = 0;
+        virtual void push(OutputStage& stage, unique_lock< mutex >& push_lock) = 0;
+        virtual OutputStage* create_output_stage() = 0;
         virtual bool peek(Segment& segment, const int& position) = 0;
         virtual inline bool flush() = 0;
         virtual inline bool replenish() = 0;
@@ -86,9 +145,12 @@ class Feed {
             return url.is_dev_null();
         };
         virtual void calibrate_resolution(const int& resolution) = 0;
-        virtual unique_lock< mutex > acquire_pull_lock() = 0;
-        virtual unique_lock< mutex > acquire_push_lock() = 0;
+        /*  lock the feed once it can take every record in the stage without waiting,
+            push never blocks so a thread holding several push locks never waits on one of them */
+        virtual unique_lock< mutex > acquire_push_lock(const OutputStage& stage) = 0;
         virtual inline bool opened() = 0;
+        /* fraction of the feed buffer holding records, sampled for progress reports */
+        virtual double occupancy() = 0;
         virtual void set_thread_pool(htsThreadPool* pool) {
             thread_pool = pool;
         };
@@ -96,6 +158,8 @@ class Feed {
     protected:
         int _capacity;
         int _resolution;
+        /* number of reads in an input batch, the initial capacity before it is aligned to the resolution */
+        int _batch_size;
         bool exhausted;
         bool initiated;
         hFILE* hfile;
@@ -118,11 +182,19 @@ class NullFeed : public Feed {
         };
         void close() override {
         };
-        bool pull(Segment& segment) override {
-            return true;
+        bool pull(const int64_t& ordinal, const int32_t& record, Segment& segment) override {
+            return false;
+        };
+        void release(const int64_t& first, const int64_t& end) override {
         };
         void push(const Segment& segment) override {
 
+        };
+        void push(OutputStage& stage, unique_lock< mutex >& push_lock) override {
+
+        };
+        OutputStage* create_output_stage() override {
+            return NULL;
         };
         bool peek(Segment& segment, const int& position) override {
             return false;
@@ -136,17 +208,16 @@ class NullFeed : public Feed {
         void calibrate_resolution(const int& resolution) override {
 
         };
-        unique_lock< mutex > acquire_pull_lock() override {
-            unique_lock< mutex > queue_lock(null_mutex);
-            return queue_lock;
-        };
-        unique_lock< mutex > acquire_push_lock() override {
+        unique_lock< mutex > acquire_push_lock(const OutputStage& stage) override {
             unique_lock< mutex > queue_lock(null_mutex);
             return queue_lock;
         };
         inline bool opened() override {
             return true;
         };
+        double occupancy() override {
+            return 0;
+        };
         void set_thread_pool(htsThreadPool* pool) override {
 
         };
@@ -156,12 +227,13 @@ template < class T > class CyclicBuffer {
     template < typename U > friend ostream& operator<<(ostream& o, const CyclicBuffer< U >& buffer);
 
     public:
-        CyclicBuffer(const IoDirection& direction, const int& capacity, const int& resolution) :
+        CyclicBuffer(const IoDirection& direction, const int& capacity, const int& resolution, Arena& arena) :
             _direction(direction),
             _capacity(0),
             _resolution(resolution),
             _next(-1),
-            _vacant(0) {
+            _vacant(0),
+            arena(arena) {
             increase_capacity(align_to_resolution(capacity, resolution));
         };
         virtual ~CyclicBuffer() {
@@ -246,6 +318,20 @@ template < class T > class CyclicBuffer {
         inline bool is_not_empty() const {
             return _next >= 0;
         };
+        inline void clear() {
+            _next = -1;
+            _vacant = 0;
+        };
+        void migrate(CyclicBuffer< T >* other) {
+            /* move records from the front of other to the back of this buffer */
+            while(is_not_full() && other->is_not_empty()) {
+                T* migrated = other->cache[other->_next];
+                other->cache[other->_next] = cache[_vacant];
+                cache[_vacant] = migrated;
+                other->decrement();
+                increment();
+            }
+        };
         void sync(CyclicBuffer< T >* other) {
             while(size() % _resolution != 0) {
                 T* migrated = other->cache[other->_next];
@@ -274,32 +360,155 @@ template < class T > class CyclicBuffer {
         int _vacant;
         vector< T* > cache;
         int index;
+
+        /*  records are placed contiguously in the arena of the feed and may migrate between
+            every buffer sharing it, a buffer only destructs the records it holds */
+        Arena& arena;
         virtual int increase_capacity(const int& capacity);
 };
 template< typename T > ostream& operator<<(ostream& o, const CyclicBuffer< T >& buffer);
 
+/*  Input batch ring
+
+    Once an input feed is started the replenishing thread fills batches of batch_size() reads,
+    resolution() records each, into a ring of INPUT_BATCH_RING_DEPTH slots. Reads are addressed
+    by their ordinal in the input, read n is in batch n / batch_size() held by slot batch % depth,
+    so every input feed can independently locate the records of the same read.
+
+    A slot is published by storing the batch number with release semantics and is handed back to
+    the producer once every record in it was released. A decoding thread releases the records it pulled
+    for a range of reads with one atomic increment for every slot the range spans. Neither side takes
+    a lock, a thread waiting for the other side backs off. The batch following the last one
+    is recorded as terminal so pulling a read beyond the end of the input returns false.
+    A stopped feed stops replenishing even when a slot was never fully released.
+*/
+const int32_t INPUT_BATCH_RING_DEPTH(4);
+
+template < class T > class InputBatch {
+    public:
+        InputBatch(InputBatch const &) = delete;
+        void operator=(InputBatch const &) = delete;
+        CyclicBuffer< T > records;
+        /* reads in the slot, published by the release store of batch and sampled by progress reports */
+        atomic< int32_t > size;
+        atomic< int64_t > batch;
+        atomic< int32_t > pulled;
+        InputBatch(const IoDirection& direction, const int& capacity, const int& resolution, Arena& arena) :
+            records(direction, capacity, resolution, arena),
+            size(0),
+            batch(-1),
+            pulled(0) {
+        };
+};
+
 template < class T > class BufferedFeed : public Feed {
+    public:
+        class Stage : public OutputStage {
+            public:
+                CyclicBuffer< T > records;
+                kstring_t serialized;
+                int serialized_size;
+                Stage(BufferedFeed< T >& feed) :
+                    OutputStage(feed),
+                    records(IoDirection::OUT, (stage_capacity(feed) + 1) * feed.resolution(), feed.resolution(), feed.record_arena),
+                    serialized({ 0, 0, NULL }),
+                    serialized_size(0),
+                    threshold(stage_capacity(feed) * feed.resolution()),
+                    owner(feed),
+                    kbuffer({ 0, 0, NULL }) {
+                    ks_terminate(serialized);
+                    ks_terminate(kbuffer);
+                };
+                ~Stage() override {
+                    ks_free(serialized);
+                    ks_free(kbuffer);
+                };
+                void push(const Segment& segment) override {
+                    owner.encode(records.vacant(), segment);
+                    records.increment();
+                };
+                void serialize() override {
+                    /*  if the feed accepts serialized records write the staged records
+                        in their output format, this is done before the feed is locked */
+                    if(owner.is_serializable()) {
+                        while(records.is_not_empty()) {
+                            owner.serialize(records.next(), serialized, kbuffer);
+                            ++serialized_size;
+                            records.decrement();
+                        }
+                    }
+                };
+                bool is_empty() const override {
+                    return records.is_empty() && serialized_size == 0;
+                };
+                bool is_full() const override {
+                    /*  a read never pushes more than resolution segments to a feed so the
+                        spare read of capacity above the threshold can not overflow */
+                    return records.size() >= threshold;
+                };
+
+            private:
+                const int threshold;
+                const BufferedFeed< T >& owner;
+                kstring_t kbuffer;
+                static inline int stage_capacity(const BufferedFeed< T >& feed) {
+                    /*  a full stage and the spare read must fit in an empty queue,
+                        otherwise acquire_push_lock would wait for room that never comes */
+                    return max(0, min(OUTPUT_STAGE_CAPACITY, feed.capacity() / feed.resolution() - 1));
+                };
+        };
+
     private:
         inline void switch_buffer_and_queue() {
             CyclicBuffer< T >* tmp = buffer;
             buffer = queue;
             queue = tmp;
         };
+        inline void switch_serialized_buffer_and_queue() {
+            kstring_t tmp = serialized_buffer;
+            serialized_buffer = serialized_queue;
+            serialized_queue = tmp;
+            serialized_queue_size = 0;
+        };
+        inline bool is_serialized_queue_full() {
+            return serialized_queue_size >= _capacity;
+        };
         inline bool is_ready_to_flush() {
-            return queue->is_full() || exhausted;
+            return queue->is_full() || is_serialized_queue_full() || exhausted ||
+                (waiting_push > 0 && (queue->is_not_empty() || ks_not_empty(serialized_queue)));
+        };
+        inline bool can_accept(const Stage& staged) const {
+            if(staged.serialized_size > 0 && serialized_queue_size >= _capacity) {
+                return false;
+            }
+            return queue->capacity() - queue->size() >= staged.records.size();
         };
 
     public:
         BufferedFeed(const FeedProxy& proxy) :
             Feed(proxy),
             kbuffer({ 0, 0, NULL }),
-            buffer(new CyclicBuffer< T >(direction, proxy.capacity, proxy.resolution)),
-            queue(new CyclicBuffer< T >(direction, proxy.capacity, proxy.resolution)),
-            started(false) {
+            buffer(new CyclicBuffer< T >(direction, proxy.capacity, proxy.resolution, record_arena)),
+            queue(new CyclicBuffer< T >(direction, proxy.capacity, proxy.resolution, record_arena)),
+            serialized_buffer({ 0, 0, NULL }),
+            serialized_queue({ 0, 0, NULL }),
+            serialized_queue_size(0),
+            waiting_push(0),
+            started(false),
+            produced(0),
+            terminal(-1),
+            halted(false) {
             ks_terminate(kbuffer);
+            ks_terminate(serialized_buffer);
+            ks_terminate(serialized_queue);
         };
         virtual ~BufferedFeed() {
             ks_free(kbuffer);
+            ks_free(serialized_buffer);
+            ks_free(serialized_queue);
+            for(auto slot : ring) {
+                delete slot;
+            }
             delete queue;
             delete buffer;
         };
@@ -309,28 +518,61 @@ template < class T > class BufferedFeed : public Feed {
         void start() override {
             if(!started) {
                 started = true;
+                if(direction == IoDirection::IN) {
+                    ring.reserve(INPUT_BATCH_RING_DEPTH);
+                    for(int32_t i(0); i < INPUT_BATCH_RING_DEPTH; ++i) {
+                        ring.push_back(new InputBatch< T >(direction, _batch_size * _resolution, _resolution, record_arena));
+                    }
+                }
                 thread_instance = thread(&BufferedFeed::run, this);
             }
         };
         void stop() override {
-            lock_guard< mutex > feed_lock(queue_mutex);
-            exhausted = true;
-            flushable.notify_one();
-        };
-        bool pull(Segment& segment) override {
-            /*  called in a safe context after acquire_pull_lock */
-            if(queue->is_not_empty()) {
-                decode(queue->next(), segment);
-                queue->decrement();
-
-                if(queue->is_empty()) {
-                    /* wake up the replenishing thread */
-                    replenishable.notify_one();
+            halted.store(true, std::memory_order_release);
+            if(direction == IoDirection::OUT) {
+                lock_guard< mutex > feed_lock(queue_mutex);
+                exhausted = true;
+                flushable.notify_one();
+            }
+        };
+        bool pull(const int64_t& ordinal, const int32_t& record, Segment& segment) override {
+            /*  decode record, which is smaller than resolution, of the read at ordinal,
+                the caller hands the record back to the producer with release */
+            const int64_t batch(ordinal / _batch_size);
+            InputBatch< T >& slot(*ring[batch % INPUT_BATCH_RING_DEPTH]);
+            if(slot.batch.load(std::memory_order_acquire) != batch) {
+                PHENIQS_PROFILE_FEED_WAIT(pull_wait_cycles);
+                IdleTimer idle_timer;
+                int32_t attempt(0);
+                while(slot.batch.load(std::memory_order_acquire) != batch) {
+                    const int64_t end(terminal.load(std::memory_order_acquire));
+                    if(end >= 0 && batch >= end) {
+                        return false;
+                    }
+                    back_off(attempt);
                 }
+            }
+            const int32_t offset(static_cast< int32_t >(ordinal % _batch_size));
+            if(offset < slot.size.load(std::memory_order_relaxed)) {
+                decode(slot.records.at(offset * _resolution + record), segment);
                 return true;
             }
             return false;
         };
+        void release(const int64_t& first, const int64_t& end) override {
+            /*  count one record for every read in [first, end) against the slot holding it,
+                every read in the range must have been pulled from this feed */
+            int64_t ordinal(first);
+            while(ordinal < end) {
+                const int64_t batch(ordinal / _batch_size);
+                InputBatch< T >& slot(*ring[batch % INPUT_BATCH_RING_DEPTH]);
+                const int64_t last(min(end, batch * _batch_size + slot.size.load(std::memory_order_relaxed)));
+                if(ordinal < last) {
+                    slot.pulled.fetch_add(static_cast< int32_t >(last - ordinal), std::memory_order_acq_rel);
+                }
+                ordinal = (batch + 1) * _batch_size;
+            }
+        };
         void push(const Segment& segment) override {
             encode(queue->vacant(), segment);
             queue->increment();
@@ -339,6 +581,28 @@ template < class T > class BufferedFeed : public Feed {
                 flushable.notify_one();
             }
         };
+        void push(OutputStage& stage, unique_lock< mutex >& push_lock) override {
+            /*  move the staged records into the queue, the caller holds the lock returned
+                by acquire_push_lock for this stage so the queue has room for all of them */
+            Stage& staged(static_cast< Stage& >(stage));
+            if(staged.serialized_size > 0) {
+                /* serialized records are appended to the queue as a single span */
+                ks_put_string_(staged.serialized, serialized_queue);
+                serialized_queue_size += staged.serialized_size;
+                ks_clear(staged.serialized);
+                staged.serialized_size = 0;
+            }
+            queue->migrate(&staged.records);
+            if(staged.records.is_not_empty()) {
+                throw InternalError("output stage does not fit in the queue of " + string(url));
+            }
+            if(is_ready_to_flush()) {
+                flushable.notify_one();
+            }
+        };
+        OutputStage* create_output_stage() override {
+            return new Stage(*this);
+        };
         bool peek(Segment& segment, const int& position) override {
             if(queue->size() > position) {
                 decode(queue->at(position), segment);
@@ -352,6 +616,10 @@ template < class T > class BufferedFeed : public Feed {
             /*  used by the consumer to empty the buffer into output */
             unique_lock< mutex > buffer_lock(buffer_mutex);
             flush_buffer();
+            if(ks_not_empty(serialized_buffer)) {
+                flush_serialized(serialized_buffer);
+                ks_clear(serialized_buffer);
+            }
 
             /* buffer is now definitly empty */
 
@@ -360,8 +628,9 @@ template < class T > class BufferedFeed : public Feed {
 
             /* wait for is_ready_to_flush: queue is_full or feed is exhausted */
 
-            if(queue->is_not_empty()) {
+            if(queue->is_not_empty() || ks_not_empty(serialized_queue)) {
                 switch_buffer_and_queue();
+                switch_serialized_buffer_and_queue();
                 queue_not_full.notify_all();
                 return true;
             } else {
@@ -369,10 +638,44 @@ template < class T > class BufferedFeed : public Feed {
                 return false;
             }
         };
+        inline bool replenish_batch() {
+            /*  used by the producer to fill the next slot in the input batch ring */
+            InputBatch< T >& slot(*ring[produced % INPUT_BATCH_RING_DEPTH]);
+            int32_t attempt(0);
+            const int32_t expected(slot.size.load(std::memory_order_relaxed) * _resolution);
+            while(slot.pulled.load(std::memory_order_acquire) < expected) {
+                if(halted.load(std::memory_order_acquire)) {
+                    /* the decoding threads are done and will never release the rest of the slot */
+                    exhausted = true;
+                    terminal.store(produced, std::memory_order_release);
+                    return false;
+                }
+                back_off(attempt);
+            }
+
+            /* records read ahead before the feed was started are delivered first */
+            slot.records.clear();
+            slot.records.migrate(queue);
+            slot.records.migrate(buffer);
+            replenish_buffer(&slot.records);
+
+            const int32_t size(slot.records.size() / _resolution);
+            slot.size.store(size, std::memory_order_relaxed);
+            if(size > 0) {
+                slot.pulled.store(0, std::memory_order_relaxed);
+                slot.batch.store(produced, std::memory_order_release);
+                ++produced;
+                return true;
+            } else {
+                exhausted = true;
+                terminal.store(produced, std::memory_order_release);
+                return false;
+            }
+        };
         inline bool replenish() override {
             /*  used by the producer to fill the buffer from the input */
             unique_lock< mutex > buffer_lock(buffer_mutex);
-            replenish_buffer();
+            replenish_buffer(buffer);
 
             unique_lock< mutex > queue_lock(queue_mutex);
             replenishable.wait(queue_lock, [this](){ return queue->is_empty(); });
@@ -383,7 +686,6 @@ template < class T > class BufferedFeed : public Feed {
                 exhausted = true;
             }
 
-            queue_not_empty.notify_all();
             return !exhausted;
         };
         void calibrate_resolution(const int& resolution) override {
@@ -399,50 +701,93 @@ template < class T > class BufferedFeed : public Feed {
                     _resolution = resolution;
 
                     /* make sure the buffer is full */
-                    replenish_buffer();
+                    replenish_buffer(buffer);
 
                     /* move records from buffer to queue until queue is aligned with the new resolution */
                     queue->sync(buffer);
 
                     /*  make sure the buffer is full again */
-                    replenish_buffer();
+                    replenish_buffer(buffer);
 
                 } else { _resolution = resolution; }
             }
         };
-        unique_lock< mutex > acquire_pull_lock() override {
+        unique_lock< mutex > acquire_push_lock(const OutputStage& stage) override {
+            const Stage& staged(static_cast< const Stage& >(stage));
             unique_lock< mutex > queue_lock(queue_mutex);
-            queue_not_empty.wait(queue_lock, [this]() { return queue->is_not_empty() || exhausted; });
+            if(!can_accept(staged)) {
+                /*  the consumer takes a queue that is not full while a pusher is waiting for room */
+                PHENIQS_PROFILE_FEED_WAIT(push_wait_cycles);
+                IdleTimer idle_timer;
+                ++waiting_push;
+                flushable.notify_one();
+                queue_not_full.wait(queue_lock, [&]() { return can_accept(staged); });
+                --waiting_push;
+            }
             return queue_lock;
         };
-        unique_lock< mutex > acquire_push_lock() override {
-            unique_lock< mutex > queue_lock(queue_mutex);
-            queue_not_full.wait(queue_lock, [this]() { return queue->is_not_full(); });
-            return queue_lock;
+        double occupancy() override {
+            if(direction == IoDirection::IN) {
+                /*  slots in the input batch ring that were published and not yet fully pulled,
+                    a slot is compared with the reads it was published with since the last one is short */
+                int32_t occupied(0);
+                for(const auto slot : ring) {
+                    if(slot->batch.load(std::memory_order_acquire) >= 0 &&
+                        slot->pulled.load(std::memory_order_acquire) < slot->size.load(std::memory_order_relaxed) * _resolution) {
+                        ++occupied;
+                    }
+                }
+                return ring.empty() ? 0 : double(occupied) / double(ring.size());
+            } else {
+                lock_guard< mutex > queue_lock(queue_mutex);
+                const int queued(max(queue->size(), serialized_queue_size));
+                return double(queued) / double(_capacity);
+            }
         };
 
     protected:
+        /*  every record buffer of the feed, including the input ring and the output stages,
+            allocates its records from the arena so it must be destroyed after all of them */
+        Arena record_arena;
         kstring_t kbuffer;
         CyclicBuffer< T >* buffer;
         CyclicBuffer< T >* queue;
         virtual void encode(T* record, const Segment& segment) const = 0;
         virtual void decode(const T* record, Segment& segment) = 0;
-        virtual void replenish_buffer() = 0;
+        virtual void replenish_buffer(CyclicBuffer< T >* target) = 0;
         virtual void flush_buffer() = 0;
 
+        /*  feeds that can write records serialized on the decoding threads
+            override is_serializable, serialize and flush_serialized */
+        kstring_t serialized_buffer;
+        kstring_t serialized_queue;
+        int serialized_queue_size;
+        virtual bool is_serializable() const {
+            return false;
+        };
+        virtual void serialize(const T* record, kstring_t& buffer, kstring_t& scratch) const {
+        };
+        virtual void flush_serialized(const kstring_t& buffer) {
+        };
+
     private:
+        /* pushers waiting in acquire_push_lock for the queue to make room for their stage */
+        int waiting_push;
         bool started;
+        int64_t produced;
+        atomic< int64_t > terminal;
+        atomic< bool > halted;
+        vector< InputBatch< T >* > ring;
         thread thread_instance;
         mutex buffer_mutex;
         mutex queue_mutex;
-        condition_variable queue_not_empty;
         condition_variable replenishable;
         condition_variable queue_not_full;
         condition_variable flushable;
         void run() {
             switch(direction) {
                 case IoDirection::IN: {
-                    while(replenish());
+                    while(replenish_batch());
                     break;
                 };
                 case IoDirection::OUT: {
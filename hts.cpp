@@ -24,8 +24,12 @@
 template<> int CyclicBuffer< bam1_t >::increase_capacity(const int& capacity) {
     if(capacity > _capacity) {
         cache.resize(capacity);
+
+        /* zeroed like bam_init1 but contiguous, record data is still managed by htslib */
+        bam1_t* block(arena.allocate_array< bam1_t >(capacity - _capacity));
+        memset(block, 0, sizeof(bam1_t) * (capacity - _capacity));
         for(int i(_capacity); i < capacity; ++i) {
-            bam1_t* record = bam_init1();
+            bam1_t* record(block + (i - _capacity));
             if(_direction == IoDirection::OUT) {
                 record->core.pos = -1;
                 record->core.tid = -1;
@@ -51,6 +55,6 @@ template<> int CyclicBuffer< bam1_t >::increase_capacity(const int& capacity) {
 };
 template<> CyclicBuffer< bam1_t >::~CyclicBuffer() {
     for(auto record : cache) {
-        bam_destroy1(record);
+        free(record->data);
     }
 };
@@ -24,8 +24,7 @@
 
 #include "include.h"
 #include "feed.h"
-
-#define bam1_seq_set_i(s, i, c) ((s)[(i)>>0x1] = ((s)[(i)>>0x1]&0xf<<(((i)&0x1)<<0x2))|(c)<<((~(i)&0x1)<<0x2))
+#include "simd.h"
 
 ostream& operator<<(ostream& o, const bam1_t& record);
 
@@ -37,7 +36,8 @@ class HtsFeed : public BufferedFeed< bam1_t > {
             BufferedFeed< bam1_t >(proxy),
             head(proxy.head),
             hts_file(NULL),
-            hdr(NULL) {
+            hdr(NULL),
+            serialized_stream(NULL) {
         };
         void open() override {
             if(!opened()) {
@@ -139,6 +139,12 @@ class HtsFeed : public BufferedFeed< bam1_t > {
                             if(sam_hdr_write(hts_file, hdr) < 0) {
                                 throw IOError("failed to write SAM header");
                             }
+
+                            /*  SAM and BAM records written to a BGZF stream can be serialized on the decoding threads,
+                                other streams, including CRAM, are written record by record by htslib */
+                            if(url.type() == FormatType::SAM || url.type() == FormatType::BAM) {
+                                serialized_stream = hts_get_bgzfp(hts_file);
+                            }
                         } else { throw IOError("failed to open hfile " + string(url.path()) + " for writing"); }
                         break;
                     };
@@ -153,6 +159,7 @@ class HtsFeed : public BufferedFeed< bam1_t > {
                 // if(hts_close_error) cerr << hts_close_error << endl;
                 hts_close(hts_file);
                 hts_file = NULL;
+                serialized_stream = NULL;
 
                 bam_hdr_destroy(hdr);
                 hdr = NULL;
@@ -166,6 +173,7 @@ class HtsFeed : public BufferedFeed< bam1_t > {
         HtsHead head;
         htsFile* hts_file;
         sam_hdr_t* hdr;
+        BGZF* serialized_stream;
         inline void encode(bam1_t* record, const Segment& segment) const override {
             /*
                 The total size of a bam1_t record is an int32_t
@@ -213,21 +221,9 @@ class HtsFeed : public BufferedFeed< bam1_t > {
                     }
 
                     // encode nucleotide byte BAM numeric encoding into nybble BAM numeric encoding
-                    for(i = 0; i < segment.length; ++i) {
-                        bam1_seq_set_i(position, i, segment.code[i]);
-                    }
+                    pack_nibbles(segment.code, position, segment.length);
                     position += ((segment.length + 1) >> 1);
 
-                    /*  alternative sequence encoding implementation
-
-                        for(i = 0; i + 1 < segment.sequence.length; i += 2) {
-                            ++(*position) = (AsciiToAmbiguousBam[segment.sequence.code[i]] << 4) + AsciiToAmbiguousBam[segment.sequence.code[i + 1]];
-                        }
-                        if(i < segment.sequence.length) {
-                            ++(*position) = (AsciiToAmbiguousBam[segment.sequence.code[i]] << 4);
-                        }
-                    */
-
                     // encode the quality sequence
                     memcpy(position, segment.quality, segment.length);
 
@@ -237,6 +233,62 @@ class HtsFeed : public BufferedFeed< bam1_t > {
                 } else { throw OverflowError("BAM record must not exceed " + to_string(numeric_limits< int32_t >::max()) + " bytes"); }
             } else { throw OverflowError("qname must not exceed 254 characters"); }
         };
+        inline bool is_serializable() const override {
+            return serialized_stream != NULL;
+        };
+        inline void serialize(const bam1_t* record, kstring_t& buffer, kstring_t& scratch) const override {
+            switch(url.type()) {
+                case FormatType::SAM: {
+                    if(sam_format1(hdr, record, &scratch) < 0) {
+                        throw IOError("error formatting SAM record for " + string(url.path()));
+                    }
+                    ks_put_string_(scratch, buffer);
+                    ks_put_character(LINE_BREAK, buffer);
+                    break;
+                };
+                case FormatType::BAM: {
+                    /*  the BAM record layout written by bam_write1, htslib can only write a record to a BGZF stream.
+                        the qname padding nulls are not written. bam_write1 moves more than 0xffff CIGAR operations
+                        to a CG tag, pheniqs never writes a CIGAR so such a record is refused rather than reproduced */
+                    const bam1_core_t& core(record->core);
+                    if(core.n_cigar > 0xffff) {
+                        throw OverflowError("BAM record must not exceed 65535 CIGAR operations");
+                    }
+                    if(static_cast< int64_t >(core.pos) > numeric_limits< int32_t >::max() ||
+                        static_cast< int64_t >(core.mpos) > numeric_limits< int32_t >::max() ||
+                        static_cast< int64_t >(core.isize) > numeric_limits< int32_t >::max() ||
+                        static_cast< int64_t >(core.isize) < numeric_limits< int32_t >::min()) {
+                        throw OverflowError("BAM record position must not exceed " + to_string(numeric_limits< int32_t >::max()));
+                    }
+                    const uint32_t block_size(record->l_data - core.l_extranul + 32);
+                    ks_increase_by_size(buffer, block_size + 4);
+                    uint8_t* position(reinterpret_cast< uint8_t* >(buffer.s + buffer.l));
+                    u32_to_le(block_size, position);
+                    i32_to_le(core.tid, position + 4);
+                    i32_to_le(static_cast< int32_t >(core.pos), position + 8);
+                    u32_to_le(static_cast< uint32_t >(core.bin) << 16 | static_cast< uint32_t >(core.qual) << 8 | (core.l_qname - core.l_extranul), position + 12);
+                    u32_to_le(static_cast< uint32_t >(core.flag) << 16 | core.n_cigar, position + 16);
+                    i32_to_le(core.l_qseq, position + 20);
+                    i32_to_le(core.mtid, position + 24);
+                    i32_to_le(static_cast< int32_t >(core.mpos), position + 28);
+                    i32_to_le(static_cast< int32_t >(core.isize), position + 32);
+                    position += 36;
+                    memcpy(position, record->data, core.l_qname - core.l_extranul);
+                    position += core.l_qname - core.l_extranul;
+                    memcpy(position, record->data + core.l_qname, record->l_data - core.l_qname);
+                    buffer.l += block_size + 4;
+                    break;
+                };
+                default:
+                    break;
+            }
+        };
+        inline void flush_serialized(const kstring_t& buffer) override {
+            /* sam_write1 writes SAM and BAM records to the same BGZF stream */
+            if(bgzf_write(serialized_stream, buffer.s, buffer.l) < 0) {
+                throw IOError("error writing to " + string(url.path()));
+            }
+        };
         inline void decode(const bam1_t* record, Segment& segment) override {
             /*  copy the identifier to the segment
                 l_qname is :
@@ -248,12 +300,10 @@ class HtsFeed : public BufferedFeed< bam1_t > {
             ks_put_string(bam_get_qname(record), record->core.l_qname - record->core.l_extranul - 1, segment.name);
 
             /* copy the sequence */
-            uint8_t* bam_seq(bam_get_seq(record));
             segment.increase_to_size(record->core.l_qseq);
-            for(int32_t i(0); i < record->core.l_qseq; ++i) {
-                /* pad 4bit BAM numeric encoding to 8bit */
-                segment.code[i] = bam_seqi(bam_seq, i);
-            }
+
+            /* pad 4bit BAM numeric encoding to 8bit */
+            unpack_nibbles(bam_get_seq(record), segment.code, record->core.l_qseq);
             segment.code[record->core.l_qseq] = '\0';
 
             /* copy the quality */
@@ -279,13 +329,13 @@ class HtsFeed : public BufferedFeed< bam1_t > {
             segment.flag = record->core.flag;
             segment.auxiliary.decode(record);
         };
-        inline void replenish_buffer() override {
-            while(opened() && buffer->is_not_full()) {
-                if(sam_read1(hts_file, hdr, buffer->vacant()) < 0) {
+        inline void replenish_buffer(CyclicBuffer< bam1_t >* target) override {
+            while(opened() && target->is_not_full()) {
+                if(sam_read1(hts_file, hdr, target->vacant()) < 0) {
                     close();
                     break;
                 } else {
-                    buffer->increment();
+                    target->increment();
                 }
             }
         };
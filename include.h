@@ -39,6 +39,8 @@
 
 /* STL dependencies */
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <condition_variable>
 #include <cstddef>
@@ -53,6 +55,7 @@
 #include <list>
 #include <map>
 #include <math.h>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <stdio.h>
@@ -65,12 +68,14 @@
 #include <stddef.h>
 #include <regex>
 
+using std::atomic;
 using std::cerr;
 using std::condition_variable;
 using std::cin;
 using std::cout;
 using std::endl;
 using std::exception;
+using std::exception_ptr;
 using std::fixed;
 using std::hash;
 using std::hex;
@@ -87,6 +92,7 @@ using std::list;
 using std::lock_guard;
 using std::log10;
 using std::make_pair;
+using std::make_shared;
 using std::map;
 using std::max;
 using std::min;
@@ -100,12 +106,15 @@ using std::recursive_mutex;
 using std::set;
 using std::setprecision;
 using std::setw;
+using std::shared_ptr;
 using std::left;
 using std::right;
 using std::size_t;
 using std::string;
 using std::thread;
 using std::to_string;
+using std::defer_lock;
+using std::try_to_lock;
 using std::uint16_t;
 using std::uint32_t;
 using std::uint64_t;
@@ -0,0 +1,244 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "matrix.h"
+
+static inline void score_scalar(
+    const uint8_t* code,
+    const size_t stride,
+    const size_t cardinality,
+    const int32_t length,
+    const double* substitution,
+    const uint8_t* observed,
+    const uint8_t* high_quality,
+    double* sigma_q,
+    int32_t* distance,
+    int32_t* high_quality_distance) {
+
+    for(size_t i(0); i < cardinality; ++i) {
+        double y(0);
+        double t(0);
+        double sigma(0);
+        double compensation(0);
+        int32_t d(0);
+        int32_t hqd(0);
+        for(int32_t j(0); j < length; ++j) {
+            const uint8_t& expected(code[j * stride + i]);
+            y = substitution[j * MATRIX_ROW_SIZE + expected] - compensation;
+            t = sigma + y;
+            compensation = (t - sigma) - y;
+            sigma = t;
+            if(expected != observed[j]) {
+                ++d;
+                if(high_quality[j]) {
+                    ++hqd;
+                }
+            }
+        }
+        sigma_q[i] = sigma;
+        distance[i] = d;
+        high_quality_distance[i] = hqd;
+    }
+};
+
+#if defined(PHENIQS_X86_SIMD)
+PHENIQS_TARGET_SSE41 static void score_sse41(
+    const uint8_t* code,
+    const size_t stride,
+    const int32_t length,
+    const double* substitution,
+    const uint8_t* observed,
+    const uint8_t* high_quality,
+    double* sigma_q,
+    int32_t* distance,
+    int32_t* high_quality_distance) {
+
+    /* 4 barcodes per iteration, the 4 lanes of double precision accumulators are split over 2 registers */
+    const __m128i one(_mm_set1_epi32(1));
+    for(size_t i(0); i < stride; i += MATRIX_LANE_WIDTH) {
+        __m128d sigma_low(_mm_setzero_pd());
+        __m128d sigma_high(_mm_setzero_pd());
+        __m128d compensation_low(_mm_setzero_pd());
+        __m128d compensation_high(_mm_setzero_pd());
+        __m128i d(_mm_setzero_si128());
+        __m128i hqd(_mm_setzero_si128());
+        for(int32_t j(0); j < length; ++j) {
+            const uint8_t* expected(code + j * stride + i);
+            const double* row(substitution + j * MATRIX_ROW_SIZE);
+
+            __m128d y(_mm_sub_pd(_mm_set_pd(row[expected[1]], row[expected[0]]), compensation_low));
+            __m128d t(_mm_add_pd(sigma_low, y));
+            compensation_low = _mm_sub_pd(_mm_sub_pd(t, sigma_low), y);
+            sigma_low = t;
+
+            y = _mm_sub_pd(_mm_set_pd(row[expected[3]], row[expected[2]]), compensation_high);
+            t = _mm_add_pd(sigma_high, y);
+            compensation_high = _mm_sub_pd(_mm_sub_pd(t, sigma_high), y);
+            sigma_high = t;
+
+            int32_t word;
+            memcpy(&word, expected, sizeof(int32_t));
+            __m128i lane(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(word)));
+            __m128i mismatch(_mm_andnot_si128(_mm_cmpeq_epi32(lane, _mm_set1_epi32(observed[j])), one));
+            d = _mm_add_epi32(d, mismatch);
+            if(high_quality[j]) {
+                hqd = _mm_add_epi32(hqd, mismatch);
+            }
+        }
+        _mm_storeu_pd(sigma_q + i, sigma_low);
+        _mm_storeu_pd(sigma_q + i + 2, sigma_high);
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(distance + i), d);
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(high_quality_distance + i), hqd);
+    }
+};
+
+PHENIQS_TARGET_AVX2 static void score_avx2(
+    const uint8_t* code,
+    const size_t stride,
+    const int32_t length,
+    const double* substitution,
+    const uint8_t* observed,
+    const uint8_t* high_quality,
+    double* sigma_q,
+    int32_t* distance,
+    int32_t* high_quality_distance) {
+
+    /*  4 barcodes per iteration, the substitution quality is gathered from the row by the expected code.
+        The masked gather with every lane enabled is used because the unmasked intrinsic
+        leaves its source operand undefined, which GCC reports as maybe uninitialized */
+    const __m128i one(_mm_set1_epi32(1));
+    const __m256d gather_mask(_mm256_castsi256_pd(_mm256_set1_epi64x(-1)));
+    for(size_t i(0); i < stride; i += MATRIX_LANE_WIDTH) {
+        __m256d sigma(_mm256_setzero_pd());
+        __m256d compensation(_mm256_setzero_pd());
+        __m128i d(_mm_setzero_si128());
+        __m128i hqd(_mm_setzero_si128());
+        for(int32_t j(0); j < length; ++j) {
+            int32_t word;
+            memcpy(&word, code + j * stride + i, sizeof(int32_t));
+            __m128i lane(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(word)));
+
+            __m256d y(_mm256_sub_pd(_mm256_mask_i32gather_pd(_mm256_setzero_pd(), substitution + j * MATRIX_ROW_SIZE, lane, gather_mask, sizeof(double)), compensation));
+            __m256d t(_mm256_add_pd(sigma, y));
+            compensation = _mm256_sub_pd(_mm256_sub_pd(t, sigma), y);
+            sigma = t;
+
+            __m128i mismatch(_mm_andnot_si128(_mm_cmpeq_epi32(lane, _mm_set1_epi32(observed[j])), one));
+            d = _mm_add_epi32(d, mismatch);
+            if(high_quality[j]) {
+                hqd = _mm_add_epi32(hqd, mismatch);
+            }
+        }
+        _mm256_storeu_pd(sigma_q + i, sigma);
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(distance + i), d);
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(high_quality_distance + i), hqd);
+    }
+};
+#endif
+
+BarcodeCodeMatrix::BarcodeCodeMatrix(const vector< Barcode >& barcode_array) :
+    barcode_cardinality(barcode_array.size()),
+    stride(((barcode_array.size() + MATRIX_LANE_WIDTH - 1) / MATRIX_LANE_WIDTH) * MATRIX_LANE_WIDTH),
+    nucleotide_cardinality(0) {
+
+    if(!barcode_array.empty()) {
+        const Barcode& reference = barcode_array.front();
+        for(size_t i(0); i < reference.segment_cardinality(); ++i) {
+            for(int32_t j(0); j < reference[i].length; ++j) {
+                segment_by_position.push_back(static_cast< int32_t >(i));
+                offset_by_position.push_back(j);
+            }
+        }
+        nucleotide_cardinality = static_cast< int32_t >(segment_by_position.size());
+
+        /* padding lanes hold the = code and are never reported */
+        code.resize(nucleotide_cardinality * stride, NO_NUCLEOTIDE);
+        for(size_t i(0); i < barcode_cardinality; ++i) {
+            const Barcode& barcode = barcode_array[i];
+            for(int32_t j(0); j < nucleotide_cardinality; ++j) {
+                code[j * stride + i] = barcode[segment_by_position[j]].code[offset_by_position[j]];
+            }
+        }
+    }
+};
+BarcodeMatrix::BarcodeMatrix(const vector< Barcode >& barcode_array) :
+    instruction_set(supported_instruction_set()),
+    scale(PhredScale::get_instance()),
+    codec(make_shared< const BarcodeCodeMatrix >(barcode_array)) {
+
+    load_buffer();
+};
+BarcodeMatrix::BarcodeMatrix(const BarcodeMatrix& other) :
+    instruction_set(other.instruction_set),
+    scale(other.scale),
+    codec(other.codec) {
+
+    load_buffer();
+};
+void BarcodeMatrix::load_buffer() {
+    substitution.resize(codec->nucleotide_cardinality * MATRIX_ROW_SIZE);
+    observed.resize(codec->nucleotide_cardinality);
+    high_quality.resize(codec->nucleotide_cardinality);
+    sigma_q.resize(codec->stride);
+    probability.resize(codec->stride);
+    distance.resize(codec->stride);
+    high_quality_distance.resize(codec->stride);
+};
+void BarcodeMatrix::compensated_decoding_quality(const Observation& observation, const uint8_t& high_quality_threshold) {
+    const BarcodeCodeMatrix& matrix(*codec);
+    const int32_t& nucleotide_cardinality(matrix.nucleotide_cardinality);
+    if(matrix.barcode_cardinality > 0) {
+        for(int32_t j(0); j < nucleotide_cardinality; ++j) {
+            const ObservedSequence& segment = observation[matrix.segment_by_position[j]];
+            const uint8_t& c(segment.code[matrix.offset_by_position[j]]);
+            const uint8_t& q(segment.quality[matrix.offset_by_position[j]]);
+            double* row(substitution.data() + j * MATRIX_ROW_SIZE);
+            for(uint8_t expected(0); expected < MATRIX_ROW_SIZE; ++expected) {
+                row[expected] = scale.substitution_quality(expected, c, q);
+            }
+            observed[j] = c;
+            high_quality[j] = (q >= high_quality_threshold) ? 1 : 0;
+        }
+
+        switch(instruction_set) {
+            #if defined(PHENIQS_X86_SIMD)
+            case InstructionSet::AVX2: {
+                score_avx2(matrix.code.data(), matrix.stride, nucleotide_cardinality, substitution.data(), observed.data(), high_quality.data(), sigma_q.data(), distance.data(), high_quality_distance.data());
+                break;
+            };
+            case InstructionSet::SSE41: {
+                score_sse41(matrix.code.data(), matrix.stride, nucleotide_cardinality, substitution.data(), observed.data(), high_quality.data(), sigma_q.data(), distance.data(), high_quality_distance.data());
+                break;
+            };
+            #endif
+            default: {
+                score_scalar(matrix.code.data(), matrix.stride, matrix.barcode_cardinality, nucleotide_cardinality, substitution.data(), observed.data(), high_quality.data(), sigma_q.data(), distance.data(), high_quality_distance.data());
+                break;
+            };
+        }
+    }
+};
+void BarcodeMatrix::compensated_decoding_probability(const Observation& observation, const uint8_t& high_quality_threshold) {
+    compensated_decoding_quality(observation, high_quality_threshold);
+    for(size_t i(0); i < codec->barcode_cardinality; ++i) {
+        probability[i] = pow(PHRED_PROBABILITY_BASE, sigma_q[i]);
+    }
+};
@@ -0,0 +1,85 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHENIQS_MATRIX_H
+#define PHENIQS_MATRIX_H
+
+#include "include.h"
+#include "simd.h"
+#include "barcode.h"
+
+/*  Structure of arrays barcode matrix
+
+    The codec is stored nucleotide major, code[position * stride + barcode], so the expected nucleotides
+    on a position are contiguous for consecutive barcodes and one observation is scored against many
+    barcodes at once. For every read the substitution quality of each of the 16 possible expected codes
+    on each position is resolved once from the PhredScale lookup table, leaving a row lookup,
+    a compensated addition and a comparison per barcode and position.
+
+    Every lane executes exactly the same sequence of Kahan summation operations, in the same order,
+    as Barcode::compensated_decoding_probability. Distances are identical and sigma_q is identical
+    to the last bit unless the compiler contracts the scalar path into fused multiply add instructions,
+    so probabilities agree with the scalar result within a relative epsilon of 1e-12.
+*/
+const int32_t MATRIX_ROW_SIZE(IUPAC_CODE_SIZE);
+const size_t MATRIX_LANE_WIDTH(4);
+
+/*  The nucleotide major codec is only read while scoring so copies of a matrix share it */
+class BarcodeCodeMatrix {
+    public:
+        BarcodeCodeMatrix(BarcodeCodeMatrix const &) = delete;
+        void operator=(BarcodeCodeMatrix const &) = delete;
+        const size_t barcode_cardinality;
+        const size_t stride;
+        int32_t nucleotide_cardinality;
+        vector< int32_t > segment_by_position;
+        vector< int32_t > offset_by_position;
+        vector< uint8_t > code;
+        BarcodeCodeMatrix(const vector< Barcode >& barcode_array);
+};
+
+class BarcodeMatrix {
+    public:
+        void operator=(BarcodeMatrix const &) = delete;
+        const InstructionSet instruction_set;
+        vector< double > sigma_q;
+        vector< double > probability;
+        vector< int32_t > distance;
+        vector< int32_t > high_quality_distance;
+
+        BarcodeMatrix(const vector< Barcode >& barcode_array);
+        BarcodeMatrix(const BarcodeMatrix& other);
+        inline size_t size() const {
+            return codec->barcode_cardinality;
+        };
+        void compensated_decoding_quality(const Observation& observation, const uint8_t& high_quality_threshold);
+        void compensated_decoding_probability(const Observation& observation, const uint8_t& high_quality_threshold);
+
+    private:
+        const PhredScale& scale;
+        const shared_ptr< const BarcodeCodeMatrix > codec;
+        vector< double > substitution;
+        vector< uint8_t > observed;
+        vector< uint8_t > high_quality;
+        void load_buffer();
+};
+
+#endif /* PHENIQS_MATRIX_H */
@@ -21,64 +21,212 @@
 
 #include "mdd.h"
 
+template < class T > MdNeighborhood< T >::MdNeighborhood(const vector< T >& tag_array, const vector< int32_t >& distance_tolerance, const int32_t& nucleotide_cardinality) :
+    distance_tolerance(distance_tolerance),
+    neighbor_by_sequence(packed_word_cardinality(nucleotide_cardinality)),
+    indexed(false),
+    collision_count(0),
+    key(neighbor_by_sequence.width, 0) {
+
+    if(tag_array.empty()) {
+        return;
+    }
+
+    int32_t length(0);
+    const T& reference(tag_array.front());
+    segment_offset.reserve(reference.segment_cardinality() + 1);
+    for(size_t i(0); i < reference.segment_cardinality(); ++i) {
+        segment_offset.push_back(length);
+        length += reference[i].length;
+    }
+    segment_offset.push_back(length);
+
+    const double size(neighborhood_size(tag_array.size()));
+    if(size > static_cast< double >(MAX_MDD_NEIGHBORHOOD_SIZE)) {
+        neighbor_by_sequence.reserve(tag_array.size());
+        packed_tag_array.reserve(tag_array.size());
+        for(size_t index(0); index < tag_array.size(); ++index) {
+            encode_key(tag_array[index]);
+            add_neighbor(static_cast< int32_t >(index), 0);
+            packed_tag_array.emplace_back(tag_array[index]);
+        }
+    } else {
+        neighbor_by_sequence.reserve(static_cast< size_t >(size));
+        for(size_t index(0); index < tag_array.size(); ++index) {
+            encode_key(tag_array[index]);
+            populate_neighborhood(static_cast< int32_t >(index), 0, 0, distance_tolerance[0], 0);
+        }
+        indexed = true;
+    }
+};
+template < class T > double MdNeighborhood< T >::neighborhood_size(const size_t& barcode_cardinality) const {
+    /* sum over k up to the tolerance of C(length, k) * 4 ^ k substitutions in each segment */
+    double size(static_cast< double >(barcode_cardinality));
+    for(size_t i(0); i < distance_tolerance.size(); ++i) {
+        const int32_t length(segment_offset[i + 1] - segment_offset[i]);
+        double term(1);
+        double segment_size(1);
+        for(int32_t k(1); k <= distance_tolerance[i] && k <= length; ++k) {
+            term *= 4.0 * static_cast< double >(length - k + 1) / static_cast< double >(k);
+            segment_size += term;
+        }
+        size *= segment_size;
+    }
+    return size;
+};
+template < class T > void MdNeighborhood< T >::populate_neighborhood(const int32_t& index, const size_t& segment, const int32_t& start, const int32_t& remaining, const int32_t& distance) {
+    /* leave the rest of the segment intact and move on to the next segment */
+    if(segment + 1 < distance_tolerance.size()) {
+        populate_neighborhood(index, segment + 1, 0, distance_tolerance[segment + 1], distance);
+    } else {
+        add_neighbor(index, distance);
+    }
+
+    /* substitute every position after start in the segment while tolerance permits */
+    if(remaining > 0) {
+        for(int32_t i(segment_offset[segment] + start); i < segment_offset[segment + 1]; ++i) {
+            const uint8_t original(get_packed_code(key.data(), i));
+            for(const auto& code : MDD_SUBSTITUTION_CODE) {
+                if(code != original) {
+                    set_packed_code(key.data(), i, code);
+                    populate_neighborhood(index, segment, i - segment_offset[segment] + 1, remaining - 1, distance + 1);
+                }
+            }
+            set_packed_code(key.data(), i, original);
+        }
+    }
+};
+template < class T > inline void MdNeighborhood< T >::add_neighbor(const int32_t& index, const int32_t& distance) {
+    MdNeighbor* record(neighbor_by_sequence.insert(key.data(), MdNeighbor(index, distance)));
+    if(record != NULL) {
+        MdNeighbor& neighbor(*record);
+        if(!neighbor.collision) {
+            neighbor.collision = true;
+            ++collision_count;
+        }
+        if(distance < neighbor.distance) {
+            neighbor.index = index;
+            neighbor.distance = distance;
+
+        } else if(distance == neighbor.distance) {
+            /* equally distant from two barcodes */
+            neighbor.index = -1;
+        }
+    }
+};
+template < class T > inline void MdNeighborhood< T >::encode_key(const T& element) {
+    int32_t position(0);
+    std::fill(key.begin(), key.end(), 0);
+    for(size_t i(0); i < element.segment_cardinality(); ++i) {
+        const Sequence& segment(element[i]);
+        for(int32_t j(0); j < segment.length; ++j) {
+            key[position / PACKED_NUCLEOTIDE_PER_WORD] |= uint64_t(segment.code[j]) << (4 * (position % PACKED_NUCLEOTIDE_PER_WORD));
+            ++position;
+        }
+    }
+};
+
 template < class T > MdDecoder< T >::MdDecoder(const Value& ontology) try :
     Decoder< T >(ontology),
     quality_masking_threshold(decode_value_by_key< uint8_t >("quality masking threshold", ontology)),
-    distance_tolerance(decode_value_by_key< vector< int32_t > >("distance tolerance", ontology)) {
-
-    for(auto& element : this->tag_array) {
-        element_by_sequence.emplace(make_pair(string(element), &element));
-    }
+    distance_tolerance(decode_value_by_key< vector< int32_t > >("distance tolerance", ontology)),
+    neighborhood(make_shared< const MdNeighborhood< T > >(this->tag_array, distance_tolerance, decode_value_by_key< int32_t >("nucleotide cardinality", ontology))),
+    key(neighborhood->neighbor_by_sequence.width, 0),
+    packed_observation(this->observation().segment_cardinality()) {
 
     } catch(Error& error) {
         error.push("MdDecoder");
         throw;
 };
+template < class T > MdDecoder< T >::MdDecoder(const MdDecoder< T >& other) :
+    Decoder< T >(other),
+    quality_masking_threshold(other.quality_masking_threshold),
+    distance_tolerance(other.distance_tolerance),
+    neighborhood(other.neighborhood),
+    key(other.key.size(), 0),
+    packed_observation(other.packed_observation.segment_cardinality()) {
+};
+template < class T > inline void MdDecoder< T >::encode_key(const uint8_t& threshold) {
+    /* any code other than A, C, G or T, and bases masked by threshold, count as a miss so they are looked up as N */
+    int32_t position(0);
+    std::fill(key.begin(), key.end(), 0);
+    for(size_t i(0); i < this->observation().segment_cardinality(); ++i) {
+        const ObservedSequence& segment(this->observation()[i]);
+        for(int32_t j(0); j < segment.length; ++j) {
+            uint8_t code(segment.code[j]);
+            if((code != ADENINE && code != CYTOSINE && code != GUANINE && code != THYMINE) ||
+                segment.quality[j] < threshold) {
+                code = ANY_NUCLEOTIDE;
+            }
+            key[position / PACKED_NUCLEOTIDE_PER_WORD] |= uint64_t(code) << (4 * (position % PACKED_NUCLEOTIDE_PER_WORD));
+            ++position;
+        }
+    }
+};
+template < class T > inline void MdDecoder< T >::decode_packed() {
+    const vector< PackedBarcode >& packed_tag_array(neighborhood->packed_tag_array);
+    packed_observation.assign(this->observation(), quality_masking_threshold);
+    T* best(NULL);
+    int32_t best_distance(numeric_limits< int32_t >::max());
+    bool ambiguous(false);
+    for(size_t index(0); index < packed_tag_array.size(); ++index) {
+        const PackedBarcode& barcode(packed_tag_array[index]);
+        int32_t distance(0);
+        bool successful(true);
+        for(size_t i(0); i < packed_observation.segment_cardinality(); ++i) {
+            int32_t error(packed_observation[i].masked_distance_from(barcode[i]));
+            if(error > distance_tolerance[i]) {
+                successful = false;
+                break;
+            } else {
+                distance += error;
+            }
+        }
+        if(successful) {
+            if(distance < best_distance) {
+                best = &this->tag_array[index];
+                best_distance = distance;
+                ambiguous = false;
+
+            } else if(distance == best_distance) {
+                ambiguous = true;
+            }
+        }
+    }
+    if(best != NULL && !ambiguous) {
+        this->decoded = best;
+        this->edit_distance = best_distance;
+    }
+};
 template < class T > void MdDecoder< T >::classify(const Read& input, Read& output) {
-    this->observation.clear();
-    this->rule.apply(input, this->observation);
+    this->load_observation(input);
     this->decoded = &this->unclassified;
     this->edit_distance = 0;
 
-    /* First try a perfect match to the full barcode sequence */
-    auto record = element_by_sequence.find(this->observation);
-    if(record != element_by_sequence.end()) {
-        this->decoded = record->second;
-
-    } else {
-        /* If no exact match was not found try error correction */
-        for(auto& barcode : this->tag_array) {
-            int32_t distance(0);
-            bool successful(true);
-            if(this->quality_masking_threshold > 0) {
-                for(size_t i(0); i < this->observation.segment_cardinality(); ++i) {
-                    int32_t error(this->observation[i].masked_distance_from(barcode[i], this->quality_masking_threshold));
-                    if(error > this->distance_tolerance[i]) {
-                        successful = false;
-                        break;
-                    } else {
-                        distance += error;
-                    }
-                }
-            } else {
-                for(size_t i(0); i < this->observation.segment_cardinality(); ++i) {
-                    int32_t error(this->observation[i].distance_from(barcode[i]));
-                    if(error > this->distance_tolerance[i]) {
-                        successful = false;
-                        break;
-                    } else {
-                        distance += error;
-                    }
-                }
-            }
+    /* First try a perfect match to the full barcode sequence, disregarding quality masking */
+    encode_key(0);
+    const MdNeighbor* record(neighborhood->neighbor_by_sequence.find(key.data()));
+    if(neighborhood->indexed) {
+        if(record != NULL && record->distance > 0 && this->quality_masking_threshold > 0) {
+            /* If no exact match was found look up the observation with low quality bases masked */
+            encode_key(this->quality_masking_threshold);
+            record = neighborhood->neighbor_by_sequence.find(key.data());
+        }
+        if(record != NULL && record->index >= 0) {
+            this->decoded = &this->tag_array[record->index];
+            this->edit_distance = record->distance;
+        }
 
-            if(successful) {
-                this->edit_distance = distance;
-                this->decoded = &barcode;
-                break;
-            }
+    } else if(record != NULL) {
+        if(record->index >= 0) {
+            this->decoded = &this->tag_array[record->index];
         }
+
+    } else {
+        /* If no exact match was found compare to every barcode */
+        decode_packed();
     }
+
     if(this->decoded == &this->unclassified) {
         output.set_qcfail(true);
     }
@@ -93,10 +241,14 @@ MdSampleDecoder::MdSampleDecoder(const Value& ontology) try :
         error.push("MdSampleDecoder");
         throw;
 };
+MdSampleDecoder::MdSampleDecoder(const MdSampleDecoder& other) :
+    MdDecoder< Barcode >(other),
+    rg_by_barcode_index(other.rg_by_barcode_index) {
+};
 void MdSampleDecoder::classify(const Read& input, Read& output) {
     MdDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_sample_barcode(this->observation);
-    output.append_to_corrected_sample_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_sample_barcode(this->observation());
+    output.append_to_corrected_sample_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     output.update_sample_distance(this->edit_distance);
     output.set_RG(this->rg_by_barcode_index[this->decoded->index]);
 };
@@ -108,10 +260,13 @@ MdCellularDecoder::MdCellularDecoder(const Value& ontology) try :
         error.push("MdCellularDecoder");
         throw;
 };
+MdCellularDecoder::MdCellularDecoder(const MdCellularDecoder& other) :
+    MdDecoder< Barcode >(other) {
+};
 void MdCellularDecoder::classify(const Read& input, Read& output) {
     MdDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_cellular_barcode(this->observation);
-    output.append_to_corrected_cellular_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_cellular_barcode(this->observation());
+    output.append_to_corrected_cellular_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     if(this->decoded->is_classified()) {
         output.update_cellular_distance(this->edit_distance);
     } else {
@@ -126,13 +281,16 @@ MdMolecularDecoder::MdMolecularDecoder(const Value& ontology) try :
         error.push("MdMolecularDecoder");
         throw;
 };
+MdMolecularDecoder::MdMolecularDecoder(const MdMolecularDecoder& other) :
+    MdDecoder< Barcode >(other) {
+};
 void MdMolecularDecoder::classify(const Read& input, Read& output) {
     MdDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_molecular_barcode(this->observation);
-    output.append_to_corrected_molecular_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_molecular_barcode(this->observation());
+    output.append_to_corrected_molecular_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     if(this->decoded->is_classified()) {
         output.update_molecular_distance(this->edit_distance);
     } else {
-        output.set_cellular_distance(0);
+        output.set_molecular_distance(0);
     }
 };
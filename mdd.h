@@ -24,37 +24,114 @@
 
 #include "include.h"
 #include "decoder.h"
+#include "packed.h"
+
+/*  Neighborhood index
+
+    Every sequence within the per segment distance tolerance of a barcode is enumerated when the decoder
+    is constructed so classifying a read is a single lookup of the observed bases, packed into a fixed
+    number of 64 bit words with 4 bits per nucleotide and looked up in an open addressing table
+    without allocating. Substitutions are
+    drawn from A, C, G, T and N and any other observed code is looked up as N since it can never
+    match an expected nucleotide. When quality masking is enabled bases below the threshold are also looked up
+    as N, which is identical to counting them as a miss.
+
+    A sequence reachable from more than one barcode is a collision. The nearest barcode is chosen and
+    a tie between equally distant barcodes is ambiguous and left unclassified, so the result never
+    depends on the order of the barcodes in the codec. Collisions are counted and reported.
+
+    When the neighborhood would exceed MAX_MDD_NEIGHBORHOOD_SIZE sequences only the barcodes are indexed
+    for exact matches and the remaining reads are compared to every barcode with the packed Hamming distance.
+    The scan follows the same rules, the nearest barcode within tolerance wins and a tie is left unclassified.
+*/
+const uint8_t MDD_SUBSTITUTION_CODE[] = { ADENINE, CYTOSINE, GUANINE, THYMINE, ANY_NUCLEOTIDE };
+const uint64_t MAX_MDD_NEIGHBORHOOD_SIZE(uint64_t(1) << 26);
+
+/* index of the nearest barcode in the tag array or -1 when ambiguous */
+class MdNeighbor {
+    public:
+        int32_t index;
+        int32_t distance;
+        bool collision;
+        MdNeighbor() :
+            index(-1),
+            distance(0),
+            collision(false) {
+        };
+        MdNeighbor(const int32_t& index, const int32_t& distance) :
+            index(index),
+            distance(distance),
+            collision(false) {
+        };
+};
+
+/*  The neighborhood is built once by the decoder loaded from the configuration and
+    shared read only by the copies made for every decoding thread.
+*/
+template < class T > class MdNeighborhood {
+    public:
+        MdNeighborhood(MdNeighborhood const &) = delete;
+        void operator=(MdNeighborhood const &) = delete;
+        const vector< int32_t > distance_tolerance;
+        vector< int32_t > segment_offset;
+        PackedKeyTable< MdNeighbor > neighbor_by_sequence;
+        bool indexed;
+        uint64_t collision_count;
+        /* only populated when the neighborhood is too big to index */
+        vector< PackedBarcode > packed_tag_array;
+        MdNeighborhood(const vector< T >& tag_array, const vector< int32_t >& distance_tolerance, const int32_t& nucleotide_cardinality);
+
+    private:
+        vector< uint64_t > key;
+        double neighborhood_size(const size_t& barcode_cardinality) const;
+        void populate_neighborhood(const int32_t& index, const size_t& segment, const int32_t& start, const int32_t& remaining, const int32_t& distance);
+        inline void add_neighbor(const int32_t& index, const int32_t& distance);
+        inline void encode_key(const T& element);
+};
 
 template < class T > class MdDecoder : public Decoder< T > {
     protected:
         const uint8_t quality_masking_threshold;
         const vector< int32_t > distance_tolerance;
-        unordered_map< string, T* > element_by_sequence;
+        shared_ptr< const MdNeighborhood< T > > neighborhood;
 
     public:
         MdDecoder(const Value& ontology);
+        MdDecoder(const MdDecoder< T >& other);
         inline void classify(const Read& input, Read& output) override;
+        void encode(Value& container, Document& document) const override {
+            Decoder< T >::encode(container, document);
+            if(neighborhood->collision_count > 0) {
+                encode_key_value("neighborhood collision count", neighborhood->collision_count, container, document);
+            }
+        };
 
     private:
-        inline bool match(T& barcode);
+        vector< uint64_t > key;
+        PackedObservation packed_observation;
+        inline void decode_packed();
+        inline void encode_key(const uint8_t& threshold);
 };
 
 class MdSampleDecoder : public MdDecoder< Barcode > {
     public:
         vector< string > rg_by_barcode_index;
         MdSampleDecoder(const Value& ontology);
+        MdSampleDecoder(const MdSampleDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 
 class MdCellularDecoder : public MdDecoder< Barcode > {
     public:
         MdCellularDecoder(const Value& ontology);
+        MdCellularDecoder(const MdCellularDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 
 class MdMolecularDecoder : public MdDecoder< Barcode > {
     public:
         MdMolecularDecoder(const Value& ontology);
+        MdMolecularDecoder(const MdMolecularDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 #endif /* PHENIQS_MDD_H */
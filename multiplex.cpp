@@ -155,6 +155,151 @@ CycleAccumulator& CycleAccumulator::operator+=(const CycleAccumulator& rhs) {
     return *this;
 };
 
+/*  QualityHistogram */
+
+QualityHistogram::QualityHistogram() :
+    capacity(0),
+    resolution(1),
+    resolution_shift(0),
+    narrow(NULL),
+    wide(NULL),
+    bound(0) {
+};
+QualityHistogram::QualityHistogram(const QualityHistogram& other) :
+    capacity(0),
+    resolution(1),
+    resolution_shift(0),
+    narrow(NULL),
+    wide(NULL),
+    bound(0) {
+    *this += other;
+};
+QualityHistogram::~QualityHistogram() {
+    free(narrow);
+    free(wide);
+};
+void QualityHistogram::increase_to_length(const int32_t& length) {
+    while(bin_count(length) > QUALITY_HISTOGRAM_CYCLE_BIN_LIMIT) {
+        coarsen();
+    }
+    const int32_t size(bin_count(length));
+    if(size > capacity) {
+        /* bins are the outer dimension so growing keeps the existing counters at the same offset */
+        const size_t existing(capacity * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+        const size_t expanded(size * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+        void* block(NULL);
+        if(posix_memalign(&block, QUALITY_HISTOGRAM_ALIGNMENT, expanded * sizeof(uint32_t)) != 0) {
+            throw OutOfMemoryError();
+        }
+        uint32_t* expanded_narrow(static_cast< uint32_t* >(block));
+        if(existing > 0) {
+            memcpy(expanded_narrow, narrow, existing * sizeof(uint32_t));
+        }
+        memset(expanded_narrow + existing, 0, (expanded - existing) * sizeof(uint32_t));
+        free(narrow);
+        narrow = expanded_narrow;
+
+        if(wide != NULL) {
+            uint64_t* expanded_wide(static_cast< uint64_t* >(realloc(wide, expanded * sizeof(uint64_t))));
+            if(expanded_wide == NULL) {
+                throw OutOfMemoryError();
+            }
+            memset(expanded_wide + existing, 0, (expanded - existing) * sizeof(uint64_t));
+            wide = expanded_wide;
+        }
+        capacity = size;
+    }
+};
+void QualityHistogram::coarsen() {
+    /* folding two bins can at most double a counter */
+    if(2 * bound > numeric_limits< uint32_t >::max()) {
+        spill();
+    }
+
+    /* bin i is written only after bins 2i and 2i + 1 were read so folding in place is safe */
+    const int32_t folded((capacity + 1) / 2);
+    for(int32_t i(0); i < folded; ++i) {
+        uint32_t* target(narrow + i * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+        const uint32_t* left(narrow + 2 * i * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+        if(2 * i + 1 < capacity) {
+            const uint32_t* right(left + QUALITY_HISTOGRAM_CYCLE_STRIDE);
+            for(int32_t k(0); k < QUALITY_HISTOGRAM_CYCLE_STRIDE; ++k) {
+                target[k] = left[k] + right[k];
+            }
+        } else if(target != left) {
+            memcpy(target, left, QUALITY_HISTOGRAM_CYCLE_STRIDE * sizeof(uint32_t));
+        }
+        if(wide != NULL) {
+            uint64_t* wide_target(wide + i * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+            const uint64_t* wide_left(wide + 2 * i * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+            if(2 * i + 1 < capacity) {
+                const uint64_t* wide_right(wide_left + QUALITY_HISTOGRAM_CYCLE_STRIDE);
+                for(int32_t k(0); k < QUALITY_HISTOGRAM_CYCLE_STRIDE; ++k) {
+                    wide_target[k] = wide_left[k] + wide_right[k];
+                }
+            } else if(wide_target != wide_left) {
+                memcpy(wide_target, wide_left, QUALITY_HISTOGRAM_CYCLE_STRIDE * sizeof(uint64_t));
+            }
+        }
+    }
+    const size_t retained(folded * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+    const size_t released((capacity - folded) * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+    memset(narrow + retained, 0, released * sizeof(uint32_t));
+    if(wide != NULL) {
+        memset(wide + retained, 0, released * sizeof(uint64_t));
+    }
+    bound *= 2;
+    resolution *= 2;
+    ++resolution_shift;
+};
+void QualityHistogram::spill() {
+    if(capacity > 0) {
+        const size_t size(capacity * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+        if(wide == NULL) {
+            if((wide = static_cast< uint64_t* >(calloc(size, sizeof(uint64_t)))) == NULL) {
+                throw OutOfMemoryError();
+            }
+        }
+        for(size_t i(0); i < size; ++i) {
+            wide[i] += narrow[i];
+        }
+        memset(narrow, 0, size * sizeof(uint32_t));
+    }
+    bound = 0;
+};
+QualityHistogram& QualityHistogram::operator+=(const QualityHistogram& rhs) {
+    if(rhs.capacity > 0) {
+        while(resolution < rhs.resolution) {
+            coarsen();
+        }
+        increase_to_length(rhs.capacity * rhs.resolution);
+
+        /* bin j of the finer rhs lands in bin j >> shift */
+        const int32_t shift(resolution_shift - rhs.resolution_shift);
+        const uint64_t increase(rhs.bound << shift);
+        if(rhs.wide != NULL || bound + increase > numeric_limits< uint32_t >::max()) {
+            spill();
+            for(int32_t j(0); j < rhs.capacity; ++j) {
+                uint64_t* target(wide + (j >> shift) * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+                const size_t offset(j * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+                for(int32_t k(0); k < QUALITY_HISTOGRAM_CYCLE_STRIDE; ++k) {
+                    target[k] += (rhs.wide != NULL ? rhs.wide[offset + k] : 0) + rhs.narrow[offset + k];
+                }
+            }
+        } else {
+            for(int32_t j(0); j < rhs.capacity; ++j) {
+                uint32_t* target(narrow + (j >> shift) * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+                const uint32_t* source(rhs.narrow + j * QUALITY_HISTOGRAM_CYCLE_STRIDE);
+                for(int32_t k(0); k < QUALITY_HISTOGRAM_CYCLE_STRIDE; ++k) {
+                    target[k] += source[k];
+                }
+            }
+            bound += increase;
+        }
+    }
+    return *this;
+};
+
 /*  SegmentAccumulator */
 
 SegmentAccumulator::SegmentAccumulator() try :
@@ -170,24 +315,30 @@ void SegmentAccumulator::finalize() {
     if(shortest == numeric_limits< int32_t >::max()) {
         shortest = 0;
     }
+
+    /* unpack the histogram into the per cycle bin distributions and count the nucleotides on the way */
+    const int32_t bins(quality_histogram.bin_count(capacity));
+    cycle_by_index.resize(bins);
+    for(int32_t c(0); c < bins; ++c) {
+        for(uint8_t n(0); n < IUPAC_CODE_SIZE; ++n) {
+            vector< uint64_t >& distribution(cycle_by_index[c].nucleotide_by_code[n].distribution);
+            for(uint8_t p(0); p < EFFECTIVE_PHRED_RANGE; ++p) {
+                const uint64_t value(quality_histogram.count(c, n, p));
+                distribution[p] = value;
+                nucleic_acid_count_by_code[NO_NUCLEOTIDE] += value;
+                nucleic_acid_count_by_code[n] += value;
+            }
+        }
+    }
     for(auto& c : cycle_by_index) {
         c.finalize();
     }
     average_phred.finalize();
 };
 SegmentAccumulator& SegmentAccumulator::operator+=(const SegmentAccumulator& rhs) {
-    if(rhs.capacity > capacity) {
-        cycle_by_index.resize(rhs.capacity);
-        capacity = rhs.capacity;
-    }
+    capacity = max(capacity, rhs.capacity);
     shortest = min(shortest, rhs.shortest);
-    for(uint8_t c(0); c < nucleic_acid_count_by_code.size(); ++c) {
-        nucleic_acid_count_by_code[c] += rhs.nucleic_acid_count_by_code[c];
-    }
-
-    for(int32_t i(0); i < rhs.capacity; ++i) {
-        cycle_by_index[i] += rhs.cycle_by_index[i];
-    }
+    quality_histogram += rhs.quality_histogram;
     average_phred += rhs.average_phred;
     return *this;
 };
@@ -197,6 +348,7 @@ bool encode_value(const SegmentAccumulator& value, Value& container, Document& d
 
         encode_key_value("min sequence length", value.shortest, container, document);
         encode_key_value("max sequence length", value.capacity, container, document);
+        encode_key_value("cycle resolution", value.quality_histogram.resolution, container, document);
         Value quality_control_by_cycle(kObjectType);
         Value quality_control_by_nucleotide(kArrayType);
         for(uint8_t n(0); n < value.nucleic_acid_count_by_code.size(); ++n) {
@@ -294,6 +446,12 @@ bool encode_value(const ReadAccumulator& value, Value& container, Document& docu
     } else { throw InternalError("Read container must be an array"); }
 };
 
+/*  QualityControlStage */
+
+QualityControlStage::QualityControlStage() {
+    channel_by_record.reserve(QUALITY_CONTROL_STAGE_CAPACITY);
+};
+
 /*  Channel */
 
 Channel::Channel(const Value& ontology) try :
@@ -316,6 +474,7 @@ Channel::Channel(const Channel& other) :
     output_feed_url_by_segment(other.output_feed_url_by_segment),
     output_feed_lock_order(other.output_feed_lock_order),
     output_feed_by_segment(other.output_feed_by_segment),
+    output_stage_by_segment(other.output_stage_by_segment),
     read_accumulator(other.read_accumulator) {
 };
 void Channel::populate(unordered_map< URL, Feed* >& feed_by_url) {
@@ -363,8 +522,8 @@ void Channel::encode(Value& container, Document& document) const {
         container.AddMember("quality control by segment", quality_control_by_segment.Move(), document.GetAllocator());
     } else { throw ConfigurationError("element must be a dictionary"); }
 };
-Channel& Channel::operator+=(const Channel& rhs) {
-    read_accumulator += rhs.read_accumulator;
+Channel& Channel::operator+=(const ReadAccumulator& rhs) {
+    read_accumulator += rhs;
     return *this;
 };
 template<> vector< Channel > decode_value< vector< Channel > >(const Value& container) {
@@ -386,31 +545,163 @@ template<> vector< Channel > decode_value< vector< Channel > >(const Value& cont
     return value;
 };
 
+/*  AccumulatorShard */
+
+AccumulatorShard::AccumulatorShard(const vector< Channel >& channel_by_index) {
+    read_accumulator_by_channel.reserve(channel_by_index.size());
+    for(const auto& channel : channel_by_index) {
+        read_accumulator_by_channel.emplace_back(channel.read_accumulator);
+    }
+};
+void AccumulatorShard::increment(const QualityControlStage& stage) {
+    const uint8_t* code(stage.code.data());
+    const uint8_t* quality(stage.quality.data());
+    const int32_t* length(stage.length_by_segment.data());
+    for(const auto channel_index : stage.channel_by_record) {
+        for(auto& segment_accumulator : read_accumulator_by_channel[channel_index].segment_accumulator_by_index) {
+            segment_accumulator.increment(code, quality, *length);
+            code += *length;
+            quality += *length;
+            ++length;
+        }
+    }
+};
+
 /*  Multiplexer */
 
 Multiplexer::Multiplexer(const Value& ontology) try :
     filter_outgoing_qc_fail(decode_value_by_key< bool >("filter outgoing qc fail", ontology)),
     enable_quality_control(decode_value_by_key< bool >("enable quality control", ontology)),
-    channel_by_index(decode_value< vector< Channel > >(ontology)) {
+    channel_by_index(decode_value< vector< Channel > >(ontology)),
+    origin(true),
+    home_shard_index(0) {
 
     } catch(Error& error) {
         error.push("Multiplexer");
         throw;
 };
-Multiplexer::Multiplexer(const Multiplexer& other) :
+Multiplexer::Multiplexer(const Multiplexer& other, const int32_t& index) :
     filter_outgoing_qc_fail(other.filter_outgoing_qc_fail),
     enable_quality_control(other.enable_quality_control),
-    channel_by_index(other.channel_by_index) {
+    channel_by_index(other.channel_by_index),
+    origin(false),
+    home_shard_index(other.accumulator_shard_array.empty() ? 0 : index % static_cast< int32_t >(other.accumulator_shard_array.size())),
+    accumulator_shard_array(other.accumulator_shard_array) {
+    load_output_stage();
+};
+Multiplexer::~Multiplexer() {
+    for(auto stage : output_stage_lock_order) {
+        delete stage;
+    }
+
+    /* shards are shared by the thread copies and owned by the multiplexer they were copied from */
+    if(origin) {
+        for(auto shard : accumulator_shard_array) {
+            delete shard;
+        }
+    }
 };
-void Multiplexer::collect(const Multiplexer& other) {
-    if(enable_quality_control) {
-        for(size_t index(0); index < channel_by_index.size(); ++index) {
-            channel_by_index[index] += other.channel_by_index[index];
+void Multiplexer::load_accumulator_shard(const int32_t& threads) {
+    if(enable_quality_control && accumulator_shard_array.empty()) {
+        int32_t shards((threads + QUALITY_CONTROL_THREADS_PER_SHARD - 1) / QUALITY_CONTROL_THREADS_PER_SHARD);
+        accumulator_shard_array.reserve(shards);
+        for(int32_t i(0); i < shards; ++i) {
+            accumulator_shard_array.push_back(new AccumulatorShard(channel_by_index));
+        }
+    }
+};
+void Multiplexer::load_output_stage() {
+    /*  every copy of the multiplexer is used by a single thread and stages records for
+        each output feed separately so records sharing a feed keep the order they were pushed in */
+    map< int32_t, Feed* > feed_by_index;
+    for(const auto& channel : channel_by_index) {
+        for(const auto feed : channel.output_feed_lock_order) {
+            feed_by_index.emplace(make_pair(feed->index, feed));
+        }
+    }
+
+    unordered_map< int32_t, OutputStage* > stage_by_index;
+    output_stage_lock_order.reserve(feed_by_index.size());
+    for(auto& record : feed_by_index) {
+        OutputStage* stage(record.second->create_output_stage());
+        if(stage != NULL) {
+            output_stage_lock_order.push_back(stage);
+            stage_by_index.emplace(make_pair(record.first, stage));
+        }
+    }
+
+    for(auto& channel : channel_by_index) {
+        channel.output_stage_by_segment.clear();
+        channel.output_stage_by_segment.reserve(channel.output_feed_by_segment.size());
+        for(const auto feed : channel.output_feed_by_segment) {
+            auto record(stage_by_index.find(feed->index));
+            channel.output_stage_by_segment.push_back(record != stage_by_index.end() ? record->second : NULL);
+        }
+    }
+};
+void Multiplexer::flush() {
+    /* serialize the staged records of feeds that accept serialized records before taking any lock */
+    vector< OutputStage* > pending;
+    pending.reserve(output_stage_lock_order.size());
+    for(const auto stage : output_stage_lock_order) {
+        if(!stage->is_empty()) {
+            stage->serialize();
+            pending.push_back(stage);
+        }
+    }
+
+    /*  acquire a push lock for every feed with staged records in a fixed order
+        so the segments of a read are written in the same order to every feed.
+        A thread only waits for room while acquiring the next lock in the order,
+        once it holds them all every stage fits and pushing never blocks */
+    vector< unique_lock< mutex > > feed_locks;
+    feed_locks.reserve(pending.size());
+    for(const auto stage : pending) {
+        feed_locks.push_back(stage->feed.acquire_push_lock(*stage));
+    }
+
+    /* hand the staged records to the output feeds */
+    for(size_t i(0); i < pending.size(); ++i) {
+        pending[i]->feed.push(*pending[i], feed_locks[i]);
+    }
+
+    /* release the locks on the feeds in reverse order */
+    for(auto feed_lock(feed_locks.rbegin()); feed_lock != feed_locks.rend(); ++feed_lock) {
+        feed_lock->unlock();
+    }
+};
+void Multiplexer::accumulate() {
+    if(!quality_control_stage.is_empty() && !accumulator_shard_array.empty()) {
+        /* take the first shard no other thread is holding before waiting on the home shard */
+        const int32_t shards(static_cast< int32_t >(accumulator_shard_array.size()));
+        for(int32_t i(0); i < shards; ++i) {
+            AccumulatorShard* shard(accumulator_shard_array[(home_shard_index + i) % shards]);
+            unique_lock< mutex > shard_lock(shard->shard_mutex, try_to_lock);
+            if(shard_lock.owns_lock()) {
+                shard->increment(quality_control_stage);
+                quality_control_stage.clear();
+                return;
+            }
+        }
+        AccumulatorShard* shard(accumulator_shard_array[home_shard_index]);
+        unique_lock< mutex > shard_lock(shard->shard_mutex, defer_lock);
+        {
+            PHENIQS_PROFILE_WAIT();
+            IdleTimer idle_timer;
+            shard_lock.lock();
         }
+        shard->increment(quality_control_stage);
+        quality_control_stage.clear();
     }
 };
 void Multiplexer::finalize() {
     if(enable_quality_control) {
+        /* fold the shards the threads accumulated into the channels */
+        for(auto shard : accumulator_shard_array) {
+            for(size_t index(0); index < channel_by_index.size(); ++index) {
+                channel_by_index[index] += shard->read_accumulator_by_channel[index];
+            }
+        }
         for(auto& channel : channel_by_index) {
             channel.finalize();
         }
@@ -25,6 +25,13 @@
 #include "include.h"
 #include "feed.h"
 
+const int32_t QUALITY_CONTROL_STAGE_CAPACITY(1024); /* reads staged by a thread before they are accumulated into a shard */
+const int32_t QUALITY_CONTROL_THREADS_PER_SHARD(8);
+const int32_t QUALITY_HISTOGRAM_ALIGNMENT(64);
+const int32_t QUALITY_HISTOGRAM_PHRED_STRIDE(48); /* EFFECTIVE_PHRED_RANGE rounded up so every row starts on a cache line */
+const int32_t QUALITY_HISTOGRAM_CYCLE_STRIDE(IUPAC_CODE_SIZE * QUALITY_HISTOGRAM_PHRED_STRIDE);
+const int32_t QUALITY_HISTOGRAM_CYCLE_BIN_LIMIT(1024);
+
 class AveragePhreadAccumulator {
     public:
         uint64_t count;
@@ -42,17 +49,17 @@ class AveragePhreadAccumulator {
             mean_value(other.mean_value),
             distribution(other.distribution) {
         };
-        inline void increment(const Segment& segment) {
+        inline void increment(const uint8_t* quality, const int32_t& length) {
             ++count;
-            double value(0);
-            for(int32_t i(0); i < segment.length; ++i) {
-                value += segment.quality[i];
+            uint32_t sum(0);
+            for(int32_t i(0); i < length; ++i) {
+                sum += quality[i];
             }
-            value /= double(segment.length);
+            const double value(double(sum) / double(length));
             sum_value += value;
             min_value = min(min_value, value);
             max_value = max(max_value, value);
-            ++(distribution[static_cast< size_t >(value)]);
+            ++(distribution[min(static_cast< size_t >(value), distribution.size() - 1)]);
         };
         void finalize();
         AveragePhreadAccumulator& operator=(const AveragePhreadAccumulator& rhs);
@@ -88,9 +95,6 @@ class NucleotideAccumulator {
             median_quality(other.median_quality),
             distribution(other.distribution) {
         };
-        inline void increment(const uint8_t phred) {
-            ++(distribution[phred]);
-        };
         inline uint64_t quantile(const double portion) {
             uint64_t position(portion * count);
             uint8_t phred(0);
@@ -118,14 +122,64 @@ class CycleAccumulator {
         CycleAccumulator(const CycleAccumulator& other) :
             nucleotide_by_code(other.nucleotide_by_code) {
         };
-        inline void increment(const uint8_t nucleotide, const uint8_t phred) {
-            nucleotide_by_code[nucleotide].increment(phred);
-        };
         void finalize();
         CycleAccumulator& operator=(const CycleAccumulator& rhs);
         CycleAccumulator& operator+=(const CycleAccumulator& rhs);
 };
 
+/*  Phred distribution of every nucleotide code on every cycle in one flat cache line aligned array
+    indexed [cycle][code][phred], so counting a base is a single increment at a computed offset.
+
+    Reads longer than QUALITY_HISTOGRAM_CYCLE_BIN_LIMIT cycles, common on long read platforms, make
+    consecutive cycles share a bin. The resolution doubles and neighboring bins are folded whenever the
+    limit is exceeded, so memory, merging and finalizing stay bounded regardless of read length.
+    Histograms of different resolution merge at the coarser one.
+
+    Counters are 32 bit and spill into a 64 bit array before any of them can overflow,
+    the 64 bit array is only allocated on the first spill. */
+class QualityHistogram {
+    public:
+        void operator=(QualityHistogram const &) = delete;
+        int32_t capacity;   /* allocated cycle bins */
+        int32_t resolution; /* cycles in a bin, a power of 2 */
+        QualityHistogram();
+        QualityHistogram(const QualityHistogram& other);
+        ~QualityHistogram();
+        inline int32_t bin_count(const int32_t& length) const {
+            return (length + resolution - 1) >> resolution_shift;
+        };
+        inline void increment(const uint8_t* code, const uint8_t* quality, const int32_t& length) {
+            if(length > capacity * resolution) {
+                increase_to_length(length);
+            }
+
+            /* a read adds at most resolution to every counter */
+            if(bound + resolution > numeric_limits< uint32_t >::max()) {
+                spill();
+            }
+            bound += resolution;
+
+            for(int32_t i(0); i < length; ++i) {
+                const uint8_t phred(quality[i] < EFFECTIVE_PHRED_RANGE ? quality[i] : EFFECTIVE_PHRED_RANGE - 1);
+                ++(narrow[(i >> resolution_shift) * QUALITY_HISTOGRAM_CYCLE_STRIDE + code[i] * QUALITY_HISTOGRAM_PHRED_STRIDE + phred]);
+            }
+        };
+        inline uint64_t count(const int32_t& bin, const uint8_t& code, const uint8_t& phred) const {
+            const size_t offset(bin * QUALITY_HISTOGRAM_CYCLE_STRIDE + code * QUALITY_HISTOGRAM_PHRED_STRIDE + phred);
+            return wide != NULL ? wide[offset] + narrow[offset] : narrow[offset];
+        };
+        QualityHistogram& operator+=(const QualityHistogram& rhs);
+
+    private:
+        int32_t resolution_shift;
+        uint32_t* narrow;
+        uint64_t* wide;
+        uint64_t bound; /* no narrow counter exceeds it */
+        void increase_to_length(const int32_t& length);
+        void coarsen();
+        void spill();
+};
+
 class SegmentAccumulator {
     public:
         void operator=(SegmentAccumulator const &) = delete;
@@ -133,6 +187,9 @@ class SegmentAccumulator {
         int32_t shortest;
         vector < uint64_t > nucleic_acid_count_by_code;
         AveragePhreadAccumulator average_phred;
+        QualityHistogram quality_histogram;
+
+        /* populated from the histogram on finalize */
         vector< CycleAccumulator > cycle_by_index;
         SegmentAccumulator();
         SegmentAccumulator(const SegmentAccumulator& other) :
@@ -141,22 +198,18 @@ class SegmentAccumulator {
             shortest(other.shortest),
             nucleic_acid_count_by_code(other.nucleic_acid_count_by_code),
             average_phred(other.average_phred),
+            quality_histogram(other.quality_histogram),
             cycle_by_index(other.cycle_by_index) {
         };
-        inline void increment(const Segment& segment) {
-            if(segment.length > capacity) {
-                cycle_by_index.resize(segment.length);
-                capacity = segment.length;
+        inline void increment(const uint8_t* code, const uint8_t* quality, const int32_t& length) {
+            if(length > capacity) {
+                capacity = length;
             }
-            if(segment.length < shortest) {
-                shortest = segment.length;
+            if(length < shortest) {
+                shortest = length;
             }
-            for(int32_t i(0); i < segment.length; ++i) {
-                ++(nucleic_acid_count_by_code[NO_NUCLEOTIDE]);
-                ++(nucleic_acid_count_by_code[segment.code[i]]);
-                cycle_by_index[i].increment(segment.code[i], segment.quality[i]);
-            }
-            average_phred.increment(segment);
+            quality_histogram.increment(code, quality, length);
+            average_phred.increment(quality, length);
         };
         void finalize();
         SegmentAccumulator& operator+=(const SegmentAccumulator& rhs);
@@ -171,16 +224,49 @@ class ReadAccumulator {
         ReadAccumulator(const ReadAccumulator& other) :
             segment_accumulator_by_index(other.segment_accumulator_by_index) {
         };
-        inline void increment(const Read& read) {
-            for(size_t i(0); i < segment_accumulator_by_index.size(); ++i) {
-                segment_accumulator_by_index[i].increment(read[i]);
-            }
-        };
         void finalize();
         ReadAccumulator& operator+=(const ReadAccumulator& rhs);
 };
 bool encode_value(const ReadAccumulator& value, Value& container, Document& document);
 
+/*  Bases and qualities of the reads a thread pushed, laid out back to back so they can be
+    accumulated in one pass while holding the lock on a shard */
+class QualityControlStage {
+    public:
+        void operator=(QualityControlStage const &) = delete;
+        QualityControlStage(QualityControlStage const &) = delete;
+        vector< int32_t > channel_by_record;
+        vector< int32_t > length_by_segment;
+        vector< uint8_t > code;
+        vector< uint8_t > quality;
+
+        QualityControlStage();
+        inline int32_t size() const {
+            return static_cast< int32_t >(channel_by_record.size());
+        };
+        inline bool is_empty() const {
+            return channel_by_record.empty();
+        };
+        inline bool is_full() const {
+            return size() >= QUALITY_CONTROL_STAGE_CAPACITY;
+        };
+        inline void push(const Read& read) {
+            channel_by_record.push_back(read.channel_index);
+            for(size_t i(0); i < read.segment_cardinality(); ++i) {
+                const Segment& segment(read[i]);
+                length_by_segment.push_back(segment.length);
+                code.insert(code.end(), segment.code, segment.code + segment.length);
+                quality.insert(quality.end(), segment.quality, segment.quality + segment.length);
+            }
+        };
+        inline void clear() {
+            channel_by_record.clear();
+            length_by_segment.clear();
+            code.clear();
+            quality.clear();
+        };
+};
+
 class Channel {
     public:
         void operator=(Channel const &) = delete;
@@ -191,61 +277,95 @@ class Channel {
         const list< URL > output_feed_url_by_segment;
         vector< Feed* > output_feed_lock_order;
         vector< Feed* > output_feed_by_segment;
+        vector< OutputStage* > output_stage_by_segment;
         ReadAccumulator read_accumulator;
 
         Channel(const Value& ontology);
         Channel(const Channel& other);
         inline void push(const Read& read) {
+            /*  encode the segments into the thread local output stages,
+                segments written to /dev/null have no stage */
             if(output_feed_lock_order.size() > 0) {
                 if(!filter_outgoing_qc_fail || !read.qcfail()) {
-                    /* acquire a push lock for all feeds in a fixed order */
-                    vector< unique_lock< mutex > > feed_locks;
-                    feed_locks.reserve(output_feed_lock_order.size());
-                    for(const auto feed : output_feed_lock_order) {
-                        feed_locks.push_back(feed->acquire_push_lock());
-                    }
-
-                    /* push the segments to the output feeds */
-                    for(size_t i(0); i < output_feed_by_segment.size(); ++i) {
-                        output_feed_by_segment[i]->push(read[i]);
-                    }
-
-                    /* release the locks on the feeds in reverse order */
-                    for(auto feed_lock(feed_locks.rbegin()); feed_lock != feed_locks.rend(); ++feed_lock) {
-                        feed_lock->unlock();
+                    for(size_t i(0); i < output_stage_by_segment.size(); ++i) {
+                        if(output_stage_by_segment[i] != NULL) {
+                            output_stage_by_segment[i]->push(read[i]);
+                        }
                     }
                 }
             }
-            if(enable_quality_control) {
-                read_accumulator.increment(read);
+        };
+        inline bool is_stage_full() const {
+            for(const auto stage : output_stage_by_segment) {
+                if(stage != NULL && stage->is_full()) {
+                    return true;
+                }
             }
+            return false;
         };
         void populate(unordered_map< URL, Feed* >& output_feed_by_url);
         void finalize();
         void encode(Value& container, Document& document) const;
-        Channel& operator+=(const Channel& rhs);
+        Channel& operator+=(const ReadAccumulator& rhs);
 };
 template<> vector< Channel > decode_value< vector< Channel > >(const Value& container);
 
+/*  A set of channel accumulators shared by several transcoding threads.
+    Threads stage the reads they push and accumulate the stage into whichever shard they can lock,
+    so quality control memory grows with the number of shards rather than the number of threads */
+class AccumulatorShard {
+    public:
+        void operator=(AccumulatorShard const &) = delete;
+        AccumulatorShard(AccumulatorShard const &) = delete;
+        mutex shard_mutex;
+        vector< ReadAccumulator > read_accumulator_by_channel;
+
+        AccumulatorShard(const vector< Channel >& channel_by_index);
+        void increment(const QualityControlStage& stage);
+};
+
 class Multiplexer {
     public:
+        void operator=(Multiplexer const &) = delete;
+        Multiplexer(Multiplexer const &) = delete;
         const bool filter_outgoing_qc_fail;
         const bool enable_quality_control;
         vector< Channel > channel_by_index;
 
         Multiplexer(const Value& ontology);
-        Multiplexer(const Multiplexer& other);
+        Multiplexer(const Multiplexer& other, const int32_t& index);
+        ~Multiplexer();
         inline void push(const Read& read) {
-            channel_by_index[read.channel_index].push(read);
+            Channel& channel(channel_by_index[read.channel_index]);
+            channel.push(read);
+            if(channel.is_stage_full()) {
+                flush();
+            }
+            if(enable_quality_control) {
+                quality_control_stage.push(read);
+                if(quality_control_stage.is_full()) {
+                    accumulate();
+                }
+            }
         };
+        void flush();
+        void accumulate();
+        void load_accumulator_shard(const int32_t& threads);
         void populate(unordered_map< URL, Feed* >& output_feed_by_url) {
             for(auto& channel : channel_by_index) {
                 channel.populate(output_feed_by_url);
             }
         };
-        void collect(const Multiplexer& other);
         void finalize();
         void encode(Value& container, Document& document) const;
+
+    private:
+        const bool origin;
+        const int32_t home_shard_index;
+        vector< AccumulatorShard* > accumulator_shard_array;
+        QualityControlStage quality_control_stage;
+        vector< OutputStage* > output_stage_lock_order;
+        void load_output_stage();
 };
 
 #endif /* PHENIQS_CHANNEL_H */
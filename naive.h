@@ -38,9 +38,8 @@ class NaiveMolecularDecoder : public Decoder< Barcode > {
             Decoder< Barcode >(other) {
         };
         inline void classify(const Read& input, Read& output) override {
-            this->observation.clear();
-            this->rule.apply(input, this->observation);
-            output.append_to_raw_molecular_barcode(this->observation);
+            this->load_observation(input);
+            output.append_to_raw_molecular_barcode(this->observation());
             Decoder< Barcode >::classify(input, output);
         };
 };
@@ -0,0 +1,324 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHENIQS_PACKED_H
+#define PHENIQS_PACKED_H
+
+#include "include.h"
+#include "barcode.h"
+
+/*  Packed sequence
+
+    Nucleotides are packed 16 to a 64 bit word as their 4 bit BAM code, nucleotide j of a word in bits 4j to 4j + 3.
+    4 bits, rather than 2, preserve all 16 IUPAC ambiguity codes so comparing packed sequences is
+    identical to comparing the BAM codes in a Sequence, a nucleotide is a mismatch when the codes differ.
+    Unused nibbles in the last word are zero in every sequence and never contribute a mismatch.
+
+    XOR of two words leaves a non zero nibble on every mismatch. Folding each nibble onto its low bit
+    and masking with PACKED_NUCLEOTIDE_LOW_BIT leaves one bit per mismatch so the distance is a popcount.
+    The mask word uses the same one bit per nucleotide layout to flag positions, on an observation those are
+    bases with quality bellow the masking threshold.
+*/
+const int32_t PACKED_NUCLEOTIDE_PER_WORD(16);
+const uint64_t PACKED_NUCLEOTIDE_LOW_BIT(0x1111111111111111);
+
+inline uint64_t packed_mismatch(const uint64_t& left, const uint64_t& right) {
+    uint64_t difference(left ^ right);
+    difference |= difference >> 1;
+    difference |= difference >> 2;
+    return difference & PACKED_NUCLEOTIDE_LOW_BIT;
+};
+
+inline int32_t packed_word_cardinality(const int32_t& length) {
+    return (length + PACKED_NUCLEOTIDE_PER_WORD - 1) / PACKED_NUCLEOTIDE_PER_WORD;
+};
+
+inline uint8_t get_packed_code(const uint64_t* word, const int32_t& position) {
+    return (word[position / PACKED_NUCLEOTIDE_PER_WORD] >> (4 * (position % PACKED_NUCLEOTIDE_PER_WORD))) & 0xf;
+};
+
+inline void set_packed_code(uint64_t* word, const int32_t& position, const uint8_t& code) {
+    const int32_t shift(4 * (position % PACKED_NUCLEOTIDE_PER_WORD));
+    uint64_t& target(word[position / PACKED_NUCLEOTIDE_PER_WORD]);
+    target = (target & ~(uint64_t(0xf) << shift)) | (uint64_t(code) << shift);
+};
+
+class PackedSequence {
+    friend ostream& operator<<(ostream& o, const PackedSequence& sequence);
+
+    public:
+        int32_t length;
+        vector< uint64_t > code;
+        vector< uint64_t > mask;
+        PackedSequence() :
+            length(0) {
+        };
+        PackedSequence(const Sequence& sequence) :
+            length(0) {
+            assign(sequence);
+        };
+        PackedSequence(const PackedSequence& other) :
+            length(other.length),
+            code(other.code),
+            mask(other.mask) {
+        };
+        inline void assign(const Sequence& sequence) {
+            resize(sequence.length);
+            for(int32_t i(0); i < length; ++i) {
+                code[i / PACKED_NUCLEOTIDE_PER_WORD] |= uint64_t(sequence.code[i]) << (4 * (i % PACKED_NUCLEOTIDE_PER_WORD));
+            }
+        };
+        inline void assign(const ObservedSequence& sequence, const uint8_t& quality_masking_threshold) {
+            /* positions with quality bellow quality_masking_threshold are flagged in the mask */
+            resize(sequence.length);
+            for(int32_t i(0); i < length; ++i) {
+                const size_t word(i / PACKED_NUCLEOTIDE_PER_WORD);
+                const int32_t shift(4 * (i % PACKED_NUCLEOTIDE_PER_WORD));
+                code[word] |= uint64_t(sequence.code[i]) << shift;
+                if(sequence.quality[i] < quality_masking_threshold) {
+                    mask[word] |= uint64_t(1) << shift;
+                }
+            }
+        };
+        inline void decode(Sequence& sequence) const {
+            sequence.increase_to_size(length);
+            for(int32_t i(0); i < length; ++i) {
+                sequence.code[i] = at(i);
+            }
+            sequence.length = length;
+            sequence.terminate();
+        };
+        inline uint8_t at(const int32_t& position) const {
+            return get_packed_code(code.data(), position);
+        };
+        inline bool is_masked(const int32_t& position) const {
+            return (mask[position / PACKED_NUCLEOTIDE_PER_WORD] >> (4 * (position % PACKED_NUCLEOTIDE_PER_WORD))) & 0x1;
+        };
+        inline int32_t distance_from(const PackedSequence& other) const {
+            /* same as Sequence::distance_from, mismatching BAM codes */
+            int32_t distance(0);
+            for(size_t i(0); i < code.size(); ++i) {
+                distance += __builtin_popcountll(packed_mismatch(code[i], other.code[i]));
+            }
+            return distance;
+        };
+        inline int32_t masked_distance_from(const PackedSequence& other) const {
+            /* same as ObservedSequence::masked_distance_from, masked positions always count as a miss */
+            int32_t distance(0);
+            for(size_t i(0); i < code.size(); ++i) {
+                distance += __builtin_popcountll(packed_mismatch(code[i], other.code[i]) | mask[i] | other.mask[i]);
+            }
+            return distance;
+        };
+        inline int32_t unmasked_distance_from(const PackedSequence& other) const {
+            /* mismatches on positions that are not masked */
+            int32_t distance(0);
+            for(size_t i(0); i < code.size(); ++i) {
+                distance += __builtin_popcountll(packed_mismatch(code[i], other.code[i]) & ~(mask[i] | other.mask[i]));
+            }
+            return distance;
+        };
+        PackedSequence& operator=(const PackedSequence& other) {
+            if(&other != this) {
+                length = other.length;
+                code = other.code;
+                mask = other.mask;
+            }
+            return *this;
+        };
+
+    private:
+        inline void resize(const int32_t& size) {
+            length = size;
+            code.assign(packed_word_cardinality(size), 0);
+            mask.assign(packed_word_cardinality(size), 0);
+        };
+};
+ostream& operator<<(ostream& o, const PackedSequence& sequence);
+
+template < class T > class PackedSequenceArray {
+    protected:
+        vector< PackedSequence > segment_array;
+
+    public:
+        PackedSequenceArray(const size_t& cardinality) :
+            segment_array(cardinality) {
+        };
+        PackedSequenceArray(const PackedSequenceArray& other) :
+            segment_array(other.segment_array) {
+        };
+        inline size_t segment_cardinality() const {
+            return segment_array.size();
+        };
+        inline void decode(T& sequence) const {
+            for(size_t i(0); i < segment_array.size(); ++i) {
+                segment_array[i].decode(sequence[i]);
+            }
+        };
+        PackedSequence& operator[](size_t index) {
+            return segment_array[index];
+        };
+        const PackedSequence& operator[](size_t index) const {
+            return segment_array[index];
+        };
+};
+
+/* Packed Barcode, index matches the index of the Barcode it was packed from */
+class PackedBarcode : public PackedSequenceArray< Barcode > {
+    public:
+        const int32_t index;
+        PackedBarcode(const Barcode& barcode) :
+            PackedSequenceArray< Barcode >(barcode.segment_cardinality()),
+            index(barcode.index) {
+            for(size_t i(0); i < segment_array.size(); ++i) {
+                segment_array[i].assign(barcode[i]);
+            }
+        };
+        PackedBarcode(const PackedBarcode& other) :
+            PackedSequenceArray< Barcode >(other),
+            index(other.index) {
+        };
+};
+
+/* Packed Observation, the mask flags bases with quality bellow a threshold */
+class PackedObservation : public PackedSequenceArray< Observation > {
+    public:
+        PackedObservation(const size_t& cardinality) :
+            PackedSequenceArray< Observation >(cardinality) {
+        };
+        inline void assign(const Observation& observation, const uint8_t& quality_masking_threshold) {
+            for(size_t i(0); i < segment_array.size(); ++i) {
+                segment_array[i].assign(observation[i], quality_masking_threshold);
+            }
+        };
+};
+
+/*  Packed key table
+
+    Open addressing hash table keyed by a fixed number of packed words. Keys and values are stored
+    in flat arrays and collisions are resolved by linear probing so a lookup does not allocate.
+    The table doubles when it is more than PACKED_KEY_TABLE_LOAD_FACTOR full.
+*/
+const double PACKED_KEY_TABLE_LOAD_FACTOR(0.7);
+
+template < class T > class PackedKeyTable {
+    public:
+        const size_t width;
+        PackedKeyTable(const size_t& width) :
+            width(width),
+            count(0),
+            capacity(0) {
+            rehash(16);
+        };
+        inline size_t size() const {
+            return count;
+        };
+        inline bool empty() const {
+            return count == 0;
+        };
+        void reserve(const size_t& cardinality) {
+            size_t needed(16);
+            while(static_cast< double >(cardinality) > PACKED_KEY_TABLE_LOAD_FACTOR * static_cast< double >(needed)) {
+                needed <<= 1;
+            }
+            if(needed > capacity) {
+                rehash(needed);
+            }
+        };
+        inline T* find(const uint64_t* key) {
+            size_t slot(hash(key) & (capacity - 1));
+            while(occupied[slot]) {
+                if(equal(key, slot)) {
+                    return &value_by_slot[slot];
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+            return NULL;
+        };
+        inline const T* find(const uint64_t* key) const {
+            return const_cast< PackedKeyTable< T >* >(this)->find(key);
+        };
+        inline T* insert(const uint64_t* key, const T& value) {
+            /* returns NULL if the key was inserted or the value already stored with the key */
+            T* existing(find(key));
+            if(existing != NULL) {
+                return existing;
+            }
+            if(static_cast< double >(count + 1) > PACKED_KEY_TABLE_LOAD_FACTOR * static_cast< double >(capacity)) {
+                rehash(capacity << 1);
+            }
+            place(key, value);
+            return NULL;
+        };
+
+    private:
+        size_t count;
+        size_t capacity;
+        vector< uint64_t > key_by_slot;
+        vector< T > value_by_slot;
+        vector< uint8_t > occupied;
+        inline size_t hash(const uint64_t* key) const {
+            uint64_t h(0x9e3779b97f4a7c15);
+            for(size_t i(0); i < width; ++i) {
+                h ^= key[i];
+                h *= 0xbf58476d1ce4e5b9;
+                h ^= h >> 31;
+            }
+            return static_cast< size_t >(h);
+        };
+        inline bool equal(const uint64_t* key, const size_t& slot) const {
+            const uint64_t* stored(key_by_slot.data() + slot * width);
+            for(size_t i(0); i < width; ++i) {
+                if(stored[i] != key[i]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        inline void place(const uint64_t* key, const T& value) {
+            size_t slot(hash(key) & (capacity - 1));
+            while(occupied[slot]) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            memcpy(key_by_slot.data() + slot * width, key, width * sizeof(uint64_t));
+            value_by_slot[slot] = value;
+            occupied[slot] = 1;
+            ++count;
+        };
+        void rehash(const size_t& size) {
+            vector< uint64_t > previous_key_by_slot(size * width, 0);
+            vector< T > previous_value_by_slot(size);
+            vector< uint8_t > previous_occupied(size, 0);
+            previous_key_by_slot.swap(key_by_slot);
+            previous_value_by_slot.swap(value_by_slot);
+            previous_occupied.swap(occupied);
+            const size_t previous_capacity(capacity);
+            capacity = size;
+            count = 0;
+            for(size_t slot(0); slot < previous_capacity; ++slot) {
+                if(previous_occupied[slot]) {
+                    place(previous_key_by_slot.data() + slot * width, previous_value_by_slot[slot]);
+                }
+            }
+        };
+};
+
+#endif /* PHENIQS_PACKED_H */
@@ -21,23 +21,159 @@
 
 #include "pamld.h"
 
+template < class T > CandidateIndex< T >::CandidateIndex(const vector< T >& tag_array, const int32_t& pruning_distance) :
+    total_concentration(0),
+    max_concentration(0) {
+
+    if(!tag_array.empty()) {
+        const T& reference = tag_array.front();
+        for(size_t i(0); i < reference.segment_cardinality(); ++i) {
+            for(int32_t j(0); j < reference[i].length; ++j) {
+                segment_by_position.push_back(static_cast< int32_t >(i));
+                offset_by_position.push_back(j);
+            }
+        }
+        const int32_t length(static_cast< int32_t >(segment_by_position.size()));
+
+        if(length > 0) {
+            /*  at least pruning_distance + 1 blocks, no block longer than MAX_PRUNING_BLOCK_LENGTH
+                so that a block is packed into a 64 bit key, and no more blocks than nucleotides */
+            int32_t block_cardinality(max(pruning_distance + 1, (length + MAX_PRUNING_BLOCK_LENGTH - 1) / MAX_PRUNING_BLOCK_LENGTH));
+            block_cardinality = min(block_cardinality, length);
+            for(int32_t i(0); i < block_cardinality; ++i) {
+                block_start.push_back((i * length) / block_cardinality);
+                block_end.push_back(((i + 1) * length) / block_cardinality);
+            }
+
+            expected_code_by_position.resize(length, 0);
+            candidate_by_block.resize(block_cardinality);
+            for(size_t index(0); index < tag_array.size(); ++index) {
+                const T& barcode = tag_array[index];
+                for(int32_t position(0); position < length; ++position) {
+                    expected_code_by_position[position] |= 1 << barcode[segment_by_position[position]].code[offset_by_position[position]];
+                }
+                for(int32_t block(0); block < block_cardinality; ++block) {
+                    uint64_t key(0);
+                    for(int32_t position(block_start[block]); position < block_end[block]; ++position) {
+                        key = key << 4 | barcode[segment_by_position[position]].code[offset_by_position[position]];
+                    }
+                    candidate_by_block[block][key].push_back(static_cast< int32_t >(index));
+                }
+                total_concentration += barcode.concentration;
+                max_concentration = max(max_concentration, barcode.concentration);
+            }
+            packed_tag_array.reserve(tag_array.size());
+            for(const auto& barcode : tag_array) {
+                packed_tag_array.emplace_back(barcode);
+            }
+        }
+    }
+};
+
 template < class T > PamlDecoder< T >::PamlDecoder(const Value& ontology) try :
     Decoder< T >(ontology),
     noise(decode_value_by_key< double >("noise", ontology)),
     confidence_threshold(decode_value_by_key< double >("confidence threshold", ontology)),
     random_barcode_probability(decode_value_by_key< double >("random barcode probability", ontology)),
     adjusted_noise_probability(noise * random_barcode_probability),
+    log_space(decode_value_by_key< bool >("log space", ontology)),
+    noise_quality(-10.0 * log10(adjusted_noise_probability)),
+    pruning(decode_value_by_key< bool >("pruning", ontology)),
+    pruning_distance(decode_value_by_key< int32_t >("pruning distance", ontology)),
+    pruning_tolerance(decode_value_by_key< double >("pruning tolerance", ontology)),
+    cache(decode_value_by_key< bool >("cache", ontology)),
+    cache_capacity(decode_value_by_key< uint64_t >("cache capacity", ontology)),
     conditional_decoding_probability(0),
-    decoding_confidence(0) {
+    decoding_confidence(0),
+    matrix(this->tag_array),
+    stamp(0),
+    cache_hit_count(0),
+    cache_miss_count(0),
+    cache_bypass_count(0),
+    packed_observation(this->observation().segment_cardinality()) {
+
+    if(log_space) {
+        concentration_quality.reserve(this->tag_array.size());
+        for(const auto& barcode : this->tag_array) {
+            concentration_quality.push_back(-10.0 * log10(barcode.concentration));
+        }
+    }
+    if(pruning) {
+        candidate_index = make_shared< const CandidateIndex< T > >(this->tag_array, pruning_distance);
+        load_candidate_buffer();
+    }
+    if(cache) {
+        load_cache(ontology);
+    }
 
     } catch(Error& error) {
         error.push("PamlDecoder");
         throw;
 };
-template < class T > void PamlDecoder< T >::classify(const Read& input, Read& output) {
-    this->observation.clear();
-    this->rule.apply(input, this->observation);
+template < class T > PamlDecoder< T >::PamlDecoder(const PamlDecoder< T >& other) :
+    Decoder< T >(other),
+    noise(other.noise),
+    confidence_threshold(other.confidence_threshold),
+    random_barcode_probability(other.random_barcode_probability),
+    adjusted_noise_probability(other.adjusted_noise_probability),
+    log_space(other.log_space),
+    noise_quality(other.noise_quality),
+    pruning(other.pruning),
+    pruning_distance(other.pruning_distance),
+    pruning_tolerance(other.pruning_tolerance),
+    cache(other.cache),
+    cache_capacity(other.cache_capacity),
+    conditional_decoding_probability(0),
+    decoding_confidence(0),
+    matrix(other.matrix),
+    candidate_index(other.candidate_index),
+    stamp(0),
+    concentration_quality(other.concentration_quality),
+    cache_bin_by_quality(other.cache_bin_by_quality),
+    cache_hit_count(0),
+    cache_miss_count(0),
+    cache_bypass_count(0),
+    packed_observation(other.packed_observation.segment_cardinality()) {
 
+    /* the block index is shared, only the buffers used while decoding a read are allocated */
+    if(pruning) {
+        load_candidate_buffer();
+    }
+    if(cache) {
+        cache_by_observation.reserve(cache_capacity);
+    }
+};
+template < class T > void PamlDecoder< T >::load_candidate_buffer() {
+    candidate.reserve(this->tag_array.size());
+    candidate_stamp.resize(this->tag_array.size(), 0);
+    mismatch_penalty.resize(candidate_index->nucleotide_cardinality());
+};
+template < class T > void PamlDecoder< T >::load_cache(const Value& ontology) {
+    cache_bin_by_quality.resize(256, NO_CACHE_QUALITY_BIN);
+    vector< uint8_t > cache_quality_bins(decode_value_by_key< vector< uint8_t > >("cache quality bins", ontology));
+    for(size_t i(0); i < cache_quality_bins.size() && i < MAX_CACHE_QUALITY_BIN_CARDINALITY; ++i) {
+        cache_bin_by_quality[cache_quality_bins[i]] = static_cast< uint8_t >(i);
+    }
+    cache_by_observation.reserve(cache_capacity);
+};
+template < class T > bool PamlDecoder< T >::encode_cache_key() {
+    cache_key.clear();
+    for(size_t i(0); i < this->observation().segment_cardinality(); ++i) {
+        const ObservedSequence& segment = this->observation()[i];
+        if(i > 0) {
+            cache_key.push_back(static_cast< char >(NO_CACHE_QUALITY_BIN));
+        }
+        for(int32_t j(0); j < segment.length; ++j) {
+            const uint8_t& bin(cache_bin_by_quality[segment.quality[j]]);
+            if(bin == NO_CACHE_QUALITY_BIN) {
+                return false;
+            }
+            cache_key.push_back(static_cast< char >(bin << 4 | segment.code[j]));
+        }
+    }
+    return true;
+};
+template < class T > void PamlDecoder< T >::decode_exhaustive() {
     /*  Compute the posterior probability P( observed | expected ) for each barcode.
         Keep track of the channel that yield the maximal prior adjusted probability.
         If r is the observed sequence and b is the barcode sequence
@@ -51,31 +187,30 @@ template < class T > void PamlDecoder< T >::classify(const Read& input, Read& ou
     double p(0);
     double y(0);
     double t(0);
-    int32_t d(0);
-    int32_t hqd(0);
     double sigma_p(0);
     double compensation(0);
-    double conditional_probability(0);
     double adjusted_conditional_decoding_probability(0);
 
-    for(auto& barcode : this->tag_array) {
-        /*  The conditional probability, P(r|b), is the probability of the observation r
-            given b was expected.
-            P(b), barcode.concentration, is the prior probability of observing b
+    /*  The conditional probability, P(r|b), is the probability of the observation r given b was expected.
+        The barcode matrix computes P(r|b) for the entire codec at once */
+    matrix.compensated_decoding_probability(this->observation(), this->high_quality_threshold);
+
+    for(size_t index(0); index < this->tag_array.size(); ++index) {
+        /*  P(b), barcode.concentration, is the prior probability of observing b
             p is the prior adjusted conditional probability, P(b) * P(r|b),
             sigma_p is the sum of p over b  */
-        barcode.compensated_decoding_probability(this->observation, this->high_quality_threshold, conditional_probability, d, hqd);
-        p = conditional_probability * barcode.concentration;
+        T& barcode = this->tag_array[index];
+        p = matrix.probability[index] * barcode.concentration;
         y = p - compensation;
         t = sigma_p + y;
         compensation = (t - sigma_p) - y;
         sigma_p = t;
         if(p > adjusted_conditional_decoding_probability) {
             this->decoded = &barcode;
-            this->edit_distance = d;
-            this->high_quality_edit_distance = hqd;
+            this->edit_distance = matrix.distance[index];
+            this->high_quality_edit_distance = matrix.high_quality_distance[index];
             adjusted_conditional_decoding_probability = p;
-            conditional_decoding_probability = conditional_probability;
+            conditional_decoding_probability = matrix.probability[index];
         }
     }
 
@@ -90,6 +225,234 @@ template < class T > void PamlDecoder< T >::classify(const Read& input, Read& ou
         adjusted_conditional_decoding_probability is the highest prior adjusted conditional probability,
         P(r|b) of all possible b */
     decoding_confidence = adjusted_conditional_decoding_probability / sigma_p;
+};
+template < class T > void PamlDecoder< T >::decode_exhaustive_in_log_space() {
+    /*  Same as decode_exhaustive but s, the Phred scaled prior adjusted conditional probability,
+        replaces p and the best barcode is the one with the minimal s.
+        Only the decoded barcode conditional probability is exponentiated */
+    matrix.compensated_decoding_quality(this->observation(), this->high_quality_threshold);
+
+    double s(0);
+    double best(numeric_limits< double >::infinity());
+    size_t decoded_index(0);
+    for(size_t index(0); index < this->tag_array.size(); ++index) {
+        s = matrix.sigma_q[index] + concentration_quality[index];
+        if(s < best) {
+            best = s;
+            decoded_index = index;
+        }
+    }
+
+    if(best < numeric_limits< double >::infinity()) {
+        /*  sigma_p is the sum of p over b and the noise, scaled by the best p,
+            so the posterior of the decoded barcode is 1 / sigma_p */
+        double y(0);
+        double t(0);
+        double sigma_p(0);
+        double compensation(0);
+        const double cutoff(best + LOG_SPACE_PHRED_CUTOFF);
+        for(size_t index(0); index < this->tag_array.size(); ++index) {
+            s = matrix.sigma_q[index] + concentration_quality[index];
+            if(s < cutoff) {
+                y = exp((best - s) * PHRED_NATURAL_SCALE) - compensation;
+                t = sigma_p + y;
+                compensation = (t - sigma_p) - y;
+                sigma_p = t;
+            }
+        }
+        y = exp((best - noise_quality) * PHRED_NATURAL_SCALE) - compensation;
+        t = sigma_p + y;
+        compensation = (t - sigma_p) - y;
+        sigma_p = t;
+
+        this->decoded = &this->tag_array[decoded_index];
+        this->edit_distance = matrix.distance[decoded_index];
+        this->high_quality_edit_distance = matrix.high_quality_distance[decoded_index];
+        conditional_decoding_probability = pow(PHRED_PROBABILITY_BASE, matrix.sigma_q[decoded_index]);
+        decoding_confidence = 1.0 / sigma_p;
+
+    } else {
+        this->decoded = &this->unclassified;
+        conditional_decoding_probability = 0;
+        decoding_confidence = 0;
+    }
+};
+template < class T > bool PamlDecoder< T >::decode_candidates() {
+    const CandidateIndex< T >& index(*candidate_index);
+    if(index.candidate_by_block.empty()) {
+        return false;
+    }
+
+    /* collect the candidates from the block index, the stamp avoids clearing the visited mask on every read */
+    ++stamp;
+    candidate.clear();
+    for(size_t block(0); block < index.candidate_by_block.size(); ++block) {
+        uint64_t key(0);
+        for(int32_t position(index.block_start[block]); position < index.block_end[block]; ++position) {
+            key = key << 4 | this->observation()[index.segment_by_position[position]].code[index.offset_by_position[position]];
+        }
+        auto record = index.candidate_by_block[block].find(key);
+        if(record != index.candidate_by_block[block].end()) {
+            for(const auto& barcode_index : record->second) {
+                if(candidate_stamp[barcode_index] != stamp) {
+                    candidate_stamp[barcode_index] = stamp;
+                    candidate.push_back(barcode_index);
+                }
+            }
+        }
+    }
+    if(candidate.empty()) {
+        return false;
+    }
+
+    /*  Lower bound on the accumulated quality, sigma_q, of any barcode outside the candidate set.
+        The floor is the smallest substitution quality any barcode in the codec can score on each position
+        and mismatch_penalty is the smallest additional quality for a mismatch on that position.
+        A barcode outside the candidate set has at least as many mismatches as there are blocks
+        so the smallest penalties of that many positions are added to the floor. */
+    const PhredScale& scale(PhredScale::get_instance());
+    const uint8_t* code(NULL);
+    const uint8_t* quality(NULL);
+    double sigma_q(0);
+    for(size_t position(0); position < mismatch_penalty.size(); ++position) {
+        const ObservedSequence& observed = this->observation()[index.segment_by_position[position]];
+        code = observed.code + index.offset_by_position[position];
+        quality = observed.quality + index.offset_by_position[position];
+        double match(numeric_limits< double >::max());
+        double mismatch(numeric_limits< double >::max());
+        for(uint8_t expected(0); expected < IUPAC_CODE_SIZE; ++expected) {
+            if(index.expected_code_by_position[position] & (1 << expected)) {
+                double q(scale.substitution_quality(expected, *code, *quality));
+                match = min(match, q);
+                if(expected != *code) {
+                    mismatch = min(mismatch, q);
+                }
+            }
+        }
+        sigma_q += match;
+        mismatch_penalty[position] = mismatch - match;
+    }
+
+    /* partially sort the smallest penalties to the front */
+    const size_t mismatch_cardinality(min(index.candidate_by_block.size(), mismatch_penalty.size()));
+    for(size_t i(0); i < mismatch_cardinality; ++i) {
+        size_t smallest(i);
+        for(size_t j(i + 1); j < mismatch_penalty.size(); ++j) {
+            if(mismatch_penalty[j] < mismatch_penalty[smallest]) {
+                smallest = j;
+            }
+        }
+        if(smallest != i) {
+            double swap(mismatch_penalty[i]);
+            mismatch_penalty[i] = mismatch_penalty[smallest];
+            mismatch_penalty[smallest] = swap;
+        }
+        sigma_q += mismatch_penalty[i];
+    }
+    const double remainder_conditional_probability(pow(PHRED_PROBABILITY_BASE, sigma_q));
+
+    /* score the candidates, same as the exhaustive scan */
+    double p(0);
+    double y(0);
+    double t(0);
+    double sigma_p(0);
+    double compensation(0);
+    double candidate_concentration(0);
+    double conditional_probability(0);
+    double adjusted_conditional_decoding_probability(0);
+    int32_t best(-1);
+    double best_conditional_probability(0);
+
+    for(const auto& barcode_index : candidate) {
+        T& barcode = this->tag_array[barcode_index];
+        barcode.compensated_decoding_probability(this->observation(), conditional_probability);
+        p = conditional_probability * barcode.concentration;
+        y = p - compensation;
+        t = sigma_p + y;
+        compensation = (t - sigma_p) - y;
+        sigma_p = t;
+        candidate_concentration += barcode.concentration;
+        if(p > adjusted_conditional_decoding_probability) {
+            best = barcode_index;
+            adjusted_conditional_decoding_probability = p;
+            best_conditional_probability = conditional_probability;
+        }
+    }
+    y = adjusted_noise_probability - compensation;
+    t = sigma_p + y;
+    compensation = (t - sigma_p) - y;
+    sigma_p = t;
+
+    /*  the remainder can not hold the maximum and the bound must be tight enough
+        for the confidence to be within pruning_tolerance of the exhaustive result */
+    const double remainder(remainder_conditional_probability * max(index.total_concentration - candidate_concentration, 0.0));
+    if(best < 0 || remainder_conditional_probability * index.max_concentration >= adjusted_conditional_decoding_probability) {
+        return false;
+    }
+    if(remainder > pruning_tolerance * (sigma_p + remainder)) {
+        return false;
+    }
+
+    /* only the decoded barcode needs the edit distances, the packed observation masks bases bellow the high quality threshold */
+    packed_observation.assign(this->observation(), this->high_quality_threshold);
+    const PackedBarcode& packed(index.packed_tag_array[best]);
+    this->decoded = &this->tag_array[best];
+    this->edit_distance = 0;
+    this->high_quality_edit_distance = 0;
+    for(size_t i(0); i < packed_observation.segment_cardinality(); ++i) {
+        this->edit_distance += packed_observation[i].distance_from(packed[i]);
+        this->high_quality_edit_distance += packed_observation[i].unmasked_distance_from(packed[i]);
+    }
+    conditional_decoding_probability = best_conditional_probability;
+    decoding_confidence = adjusted_conditional_decoding_probability / (sigma_p + remainder);
+    return true;
+};
+template < class T > void PamlDecoder< T >::classify(const Read& input, Read& output) {
+    this->load_observation(input);
+
+    bool cacheable(false);
+    bool cached(false);
+    if(cache) {
+        if(encode_cache_key()) {
+            cacheable = true;
+            auto record = cache_by_observation.find(cache_key);
+            if(record != cache_by_observation.end()) {
+                this->decoded = record->second.decoded;
+                this->edit_distance = record->second.edit_distance;
+                this->high_quality_edit_distance = record->second.high_quality_edit_distance;
+                conditional_decoding_probability = record->second.conditional_decoding_probability;
+                decoding_confidence = record->second.decoding_confidence;
+                cached = true;
+                ++cache_hit_count;
+            } else {
+                ++cache_miss_count;
+            }
+        } else {
+            ++cache_bypass_count;
+        }
+    }
+
+    if(!cached) {
+        if(!pruning || !decode_candidates()) {
+            if(log_space) {
+                decode_exhaustive_in_log_space();
+            } else {
+                decode_exhaustive();
+            }
+        }
+        if(cacheable && cache_by_observation.size() < cache_capacity) {
+            cache_by_observation.emplace(
+                cache_key,
+                DecodingCacheRecord< T >(
+                    this->decoded,
+                    this->edit_distance,
+                    this->high_quality_edit_distance,
+                    conditional_decoding_probability,
+                    decoding_confidence
+                )
+            );
+        }
+    }
 
     /*  This is a noise filter, when the conditional probability is lower than the probability of
         a random abservation, the entropy is too high for the information to be meaningful */
@@ -130,10 +493,14 @@ PamlSampleDecoder::PamlSampleDecoder(const Value& ontology) try :
         error.push("PamlSampleDecoder");
         throw;
 };
+PamlSampleDecoder::PamlSampleDecoder(const PamlSampleDecoder& other) :
+    PamlDecoder< Barcode >(other),
+    rg_by_barcode_index(other.rg_by_barcode_index) {
+};
 void PamlSampleDecoder::classify(const Read& input, Read& output) {
     PamlDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_sample_barcode(this->observation);
-    output.append_to_corrected_sample_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_sample_barcode(this->observation());
+    output.append_to_corrected_sample_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     output.update_sample_distance(this->edit_distance);
     output.update_sample_decoding_confidence(this->decoding_confidence);
     output.set_RG(this->rg_by_barcode_index[this->decoded->index]);
@@ -146,10 +513,13 @@ PamlCellularDecoder::PamlCellularDecoder(const Value& ontology) try :
         error.push("PamlCellularDecoder");
         throw;
 };
+PamlCellularDecoder::PamlCellularDecoder(const PamlCellularDecoder& other) :
+    PamlDecoder< Barcode >(other) {
+};
 void PamlCellularDecoder::classify(const Read& input, Read& output) {
     PamlDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_cellular_barcode(this->observation);
-    output.append_to_corrected_cellular_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_cellular_barcode(this->observation());
+    output.append_to_corrected_cellular_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     if(this->decoded->is_classified()) {
         output.update_cellular_decoding_confidence(this->decoding_confidence);
         output.update_cellular_distance(this->edit_distance);
@@ -166,10 +536,13 @@ PamlMolecularDecoder::PamlMolecularDecoder(const Value& ontology) try :
         error.push("PamlMolecularDecoder");
         throw;
 };
+PamlMolecularDecoder::PamlMolecularDecoder(const PamlMolecularDecoder& other) :
+    PamlDecoder< Barcode >(other) {
+};
 void PamlMolecularDecoder::classify(const Read& input, Read& output) {
     PamlDecoder< Barcode >::classify(input, output);
-    output.append_to_raw_molecular_barcode(this->observation);
-    output.append_to_corrected_molecular_barcode_sequence(*this->decoded, this->observation, corrected_quality);
+    output.append_to_raw_molecular_barcode(this->observation());
+    output.append_to_corrected_molecular_barcode_sequence(*this->decoded, this->observation(), corrected_quality);
     if(this->decoded->is_classified()) {
         output.update_molecular_decoding_confidence(this->decoding_confidence);
         output.update_molecular_distance(this->edit_distance);
@@ -24,6 +24,92 @@
 
 #include "include.h"
 #include "decoder.h"
+#include "matrix.h"
+#include "packed.h"
+
+/*  Candidate pruning
+
+    The codec is partitioned into pruning_distance + 1 or more consecutive blocks of the concatenated barcode.
+    By the pigeonhole principle any barcode within pruning_distance of the observation matches
+    at least one block exactly so a lookup of each observed block in the block index yields a
+    candidate set that contains every barcode within that distance.
+
+    The full posterior is only computed for the candidates. Every other barcode differs
+    from the observation in at least as many positions as there are blocks, which gives an upper bound
+    on the conditional probability of the remainder. The bound is added to the denominator so the reported
+    decoding confidence never exceeds the exhaustive one, and it is lower by no more than pruning_tolerance.
+    When the bound is too loose to guarantee that the decoder falls back to the exhaustive scan.
+*/
+const int32_t MAX_PRUNING_BLOCK_LENGTH(16);
+
+/*  The block index is built once by the decoder loaded from the configuration and is only read while
+    decoding, so every copy of that decoder made for a decoding thread shares it */
+template < class T > class CandidateIndex {
+    public:
+        CandidateIndex(CandidateIndex const &) = delete;
+        void operator=(CandidateIndex const &) = delete;
+        /* flat position in the concatenated barcode to segment and offset */
+        vector< int32_t > segment_by_position;
+        vector< int32_t > offset_by_position;
+        /* bit mask of the BAM codes expected on each flat position in the codec */
+        vector< uint16_t > expected_code_by_position;
+        /* block boundaries on the concatenated barcode */
+        vector< int32_t > block_start;
+        vector< int32_t > block_end;
+        vector< unordered_map< uint64_t, vector< int32_t > > > candidate_by_block;
+        double total_concentration;
+        double max_concentration;
+        /* packed barcodes report the edit distances of the decoded candidate */
+        vector< PackedBarcode > packed_tag_array;
+        CandidateIndex(const vector< T >& tag_array, const int32_t& pruning_distance);
+        inline size_t nucleotide_cardinality() const {
+            return segment_by_position.size();
+        };
+};
+
+/*  Log space scoring
+
+    Scores are kept in the Phred domain, the prior adjusted conditional probability of barcode b
+    is P(b) * P(r|b) = 10 ^ (-s(b) / 10) where s(b) = sigma_q(b) - 10 * log10(P(b)).
+    The best barcode is the one with the minimal s and the posterior is computed from differences
+    to the best score, 1 / sum(10 ^ (-(s(b) - s(best)) / 10)), so only differences are exponentiated.
+    Barcodes that trail the best score by more than LOG_SPACE_PHRED_CUTOFF contribute less than 10 ^ -20
+    relative to the best barcode and are not exponentiated at all.
+*/
+const double LOG_SPACE_PHRED_CUTOFF(200);
+
+/*  Decoding cache
+
+    Many reads share the same observed barcode bases and, on platforms that bin quality scores,
+    the same quality scores. The cache key packs every observed nucleotide into one byte, the
+    4 bit BAM code in the low nibble and the index of the quality in cache quality bins in the high
+    nibble, with a separator between segments. Observations with a quality score that is not one
+    of the bin values bypass the cache so a cached result is always identical to decoding the read.
+*/
+const uint8_t NO_CACHE_QUALITY_BIN(0xff);
+const uint8_t MAX_CACHE_QUALITY_BIN_CARDINALITY(15);
+
+template < class T > class DecodingCacheRecord {
+    public:
+        T* decoded;
+        int32_t edit_distance;
+        int32_t high_quality_edit_distance;
+        double conditional_decoding_probability;
+        double decoding_confidence;
+        DecodingCacheRecord(
+            T* decoded,
+            const int32_t& edit_distance,
+            const int32_t& high_quality_edit_distance,
+            const double& conditional_decoding_probability,
+            const double& decoding_confidence) :
+
+            decoded(decoded),
+            edit_distance(edit_distance),
+            high_quality_edit_distance(high_quality_edit_distance),
+            conditional_decoding_probability(conditional_decoding_probability),
+            decoding_confidence(decoding_confidence) {
+        };
+};
 
 template < class T > class PamlDecoder : public Decoder< T > {
     protected:
@@ -31,12 +117,30 @@ template < class T > class PamlDecoder : public Decoder< T > {
         const double confidence_threshold;
         const double random_barcode_probability;
         const double adjusted_noise_probability;
+        const bool log_space;
+        const double noise_quality;
+        const bool pruning;
+        const int32_t pruning_distance;
+        const double pruning_tolerance;
+        const bool cache;
+        const uint64_t cache_capacity;
         double conditional_decoding_probability;
         double decoding_confidence;
+        BarcodeMatrix matrix;
 
     public:
         PamlDecoder(const Value& ontology);
+        PamlDecoder(const PamlDecoder< T >& other);
         inline void classify(const Read& input, Read& output) override;
+        inline void collect(const Classifier< T >& other) override {
+            Decoder< T >::collect(other);
+            const PamlDecoder< T >* decoder(dynamic_cast< const PamlDecoder< T >* >(&other));
+            if(decoder != NULL) {
+                cache_hit_count += decoder->cache_hit_count;
+                cache_miss_count += decoder->cache_miss_count;
+                cache_bypass_count += decoder->cache_bypass_count;
+            }
+        };
         inline void finalize() override {
             for(auto& element : this->tag_array) {
                 this->accumulated_classified_confidence += element.accumulated_confidence;
@@ -46,24 +150,57 @@ template < class T > class PamlDecoder : public Decoder< T > {
             }
             Decoder< T >::finalize();
         };
+        void encode(Value& container, Document& document) const override {
+            Decoder< T >::encode(container, document);
+            if(cache) {
+                encode_key_value("cache hit count", cache_hit_count, container, document);
+                encode_key_value("cache miss count", cache_miss_count, container, document);
+                encode_key_value("cache bypass count", cache_bypass_count, container, document);
+            }
+        };
+
+    private:
+        shared_ptr< const CandidateIndex< T > > candidate_index;
+        vector< int32_t > candidate;
+        vector< uint64_t > candidate_stamp;
+        uint64_t stamp;
+        vector< double > mismatch_penalty;
+        /* -10 * log10 of the barcode concentration */
+        vector< double > concentration_quality;
+        vector< uint8_t > cache_bin_by_quality;
+        string cache_key;
+        unordered_map< string, DecodingCacheRecord< T > > cache_by_observation;
+        uint64_t cache_hit_count;
+        uint64_t cache_miss_count;
+        uint64_t cache_bypass_count;
+        PackedObservation packed_observation;
+        void load_candidate_buffer();
+        void load_cache(const Value& ontology);
+        inline bool encode_cache_key();
+        inline void decode_exhaustive();
+        inline void decode_exhaustive_in_log_space();
+        inline bool decode_candidates();
 };
 
 class PamlSampleDecoder : public PamlDecoder< Barcode > {
     public:
         vector< string > rg_by_barcode_index;
         PamlSampleDecoder(const Value& ontology);
+        PamlSampleDecoder(const PamlSampleDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 
 class PamlCellularDecoder : public PamlDecoder< Barcode > {
     public:
         PamlCellularDecoder(const Value& ontology);
+        PamlCellularDecoder(const PamlCellularDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 
 class PamlMolecularDecoder : public PamlDecoder< Barcode > {
     public:
         PamlMolecularDecoder(const Value& ontology);
+        PamlMolecularDecoder(const PamlMolecularDecoder& other);
         inline void classify(const Read& input, Read& output) override;
 };
 
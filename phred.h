@@ -32,6 +32,8 @@ const uint8_t MAX_PHRED_VALUE(104);
 const uint8_t EFFECTIVE_PHRED_RANGE(42);
 const double UNIFORM_BASE_QUALITY(10.0 * log10(4));
 const double PHRED_PROBABILITY_BASE(pow(10.0, -0.1));
+/* natural logarithm of 10 ^ 0.1, pow(PHRED_PROBABILITY_BASE, q) == exp(-q * PHRED_NATURAL_SCALE) */
+const double PHRED_NATURAL_SCALE(log(10.0) / 10.0);
 const int32_t DISPLAY_FLOAT_PRECISION(16);
 
 /*  Substitution lookup table
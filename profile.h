@@ -0,0 +1,186 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHENIQS_PROFILE_H
+#define PHENIQS_PROFILE_H
+
+#include "include.h"
+
+/*  Stage profile
+
+    Compiled in only when PHENIQS_STAGE_PROFILE is defined, `make with-stage-profile=1`.
+    Every transcoding thread accumulates the cycles spent in each stage of the hot path into
+    its own counters so the instrumentation never shares a cache line between threads.
+    Time a thread spends waiting on a lock or on another thread is added to a thread local
+    counter by the code that waits, and a stage timer attributes the difference to its stage.
+    Cycles are converted to seconds when reported using the rate measured over the whole run.
+*/
+/*  Idle time
+
+    Always compiled in, unlike the stage profile. A transcoding thread measures the wall time it spends
+    waiting on another thread, for an input batch to be published, for room in an output queue or
+    for an accumulator shard, into a thread local counter that the progress report publishes.
+*/
+
+/* microseconds the calling thread spent waiting on other threads, defined in feed.cpp */
+extern thread_local uint64_t idle_wait_microseconds;
+
+/* adds the wall time elapsed during its scope to the thread idle counter */
+class IdleTimer {
+    public:
+        IdleTimer(IdleTimer const &) = delete;
+        void operator=(IdleTimer const &) = delete;
+        IdleTimer() :
+            begin(std::chrono::steady_clock::now()) {
+        };
+        ~IdleTimer() {
+            idle_wait_microseconds += static_cast< uint64_t >(
+                std::chrono::duration_cast< std::chrono::microseconds >(std::chrono::steady_clock::now() - begin).count());
+        };
+
+    private:
+        const std::chrono::steady_clock::time_point begin;
+};
+
+#if defined(PHENIQS_STAGE_PROFILE)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline uint64_t read_cycle_counter() {
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+    #else
+    return static_cast< uint64_t >(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count());
+    #endif
+};
+
+enum class ProfileStage : uint8_t {
+    PULL,
+    CLASSIFY,
+    APPLY,
+    FLUSH,
+    PUSH,
+};
+const size_t PROFILE_STAGE_CARDINALITY(5);
+inline string to_string(const ProfileStage& value) {
+    string result;
+    switch(value) {
+        case ProfileStage::PULL:        result.assign("pull");      break;
+        case ProfileStage::CLASSIFY:    result.assign("classify");  break;
+        case ProfileStage::APPLY:       result.assign("apply");     break;
+        case ProfileStage::FLUSH:       result.assign("flush");     break;
+        case ProfileStage::PUSH:        result.assign("push");      break;
+        default:                        result.assign("unknown");   break;
+    }
+    return result;
+};
+
+/* cycles the calling thread spent waiting, defined in feed.cpp */
+extern thread_local uint64_t wait_cycles;
+
+class StageProfile {
+    public:
+        uint64_t total_cycles;
+        uint64_t count_by_stage[PROFILE_STAGE_CARDINALITY];
+        uint64_t cycles_by_stage[PROFILE_STAGE_CARDINALITY];
+        uint64_t wait_cycles_by_stage[PROFILE_STAGE_CARDINALITY];
+        StageProfile() :
+            total_cycles(0),
+            count_by_stage(),
+            cycles_by_stage(),
+            wait_cycles_by_stage() {
+        };
+        StageProfile& operator+=(const StageProfile& rhs) {
+            total_cycles += rhs.total_cycles;
+            for(size_t i(0); i < PROFILE_STAGE_CARDINALITY; ++i) {
+                count_by_stage[i] += rhs.count_by_stage[i];
+                cycles_by_stage[i] += rhs.cycles_by_stage[i];
+                wait_cycles_by_stage[i] += rhs.wait_cycles_by_stage[i];
+            }
+            return *this;
+        };
+};
+
+class StageTimer {
+    public:
+        StageTimer(StageTimer const &) = delete;
+        void operator=(StageTimer const &) = delete;
+        StageTimer(StageProfile& profile, const ProfileStage& stage) :
+            profile(profile),
+            stage(static_cast< size_t >(stage)),
+            begin_wait(wait_cycles),
+            begin(read_cycle_counter()) {
+        };
+        ~StageTimer() {
+            profile.cycles_by_stage[stage] += read_cycle_counter() - begin;
+            profile.wait_cycles_by_stage[stage] += wait_cycles - begin_wait;
+            ++(profile.count_by_stage[stage]);
+        };
+
+    private:
+        StageProfile& profile;
+        const size_t stage;
+        const uint64_t begin_wait;
+        const uint64_t begin;
+};
+
+/*  adds the cycles elapsed during its scope to the thread wait counter
+    and, when waiting on a feed, to the wait counter of the feed */
+class WaitTimer {
+    public:
+        WaitTimer(WaitTimer const &) = delete;
+        void operator=(WaitTimer const &) = delete;
+        WaitTimer(atomic< uint64_t >* counter = NULL) :
+            counter(counter),
+            begin(read_cycle_counter()) {
+        };
+        ~WaitTimer() {
+            const uint64_t elapsed(read_cycle_counter() - begin);
+            wait_cycles += elapsed;
+            if(counter != NULL) {
+                counter->fetch_add(elapsed, std::memory_order_relaxed);
+            }
+        };
+
+    private:
+        atomic< uint64_t >* counter;
+        const uint64_t begin;
+};
+
+#define PHENIQS_PROFILE_STAGE(profile, stage) StageTimer stage_timer(profile, stage)
+#define PHENIQS_PROFILE_WAIT() WaitTimer wait_timer
+#define PHENIQS_PROFILE_FEED_WAIT(counter) WaitTimer wait_timer(&counter)
+
+#else
+
+#define PHENIQS_PROFILE_STAGE(profile, stage)
+#define PHENIQS_PROFILE_WAIT()
+#define PHENIQS_PROFILE_FEED_WAIT(counter)
+
+#endif /* PHENIQS_STAGE_PROFILE */
+
+#endif /* PHENIQS_PROFILE_H */
@@ -145,11 +145,24 @@ class Read : public SequenceArray< Segment > {
     protected:
         Segment* leader;
 
+        /*  barcode tag values are rendered once per read and appended to the tags of every segment */
+        kstring_t BC;
+        kstring_t QT;
+        kstring_t CR;
+        kstring_t CY;
+        kstring_t CB;
+        kstring_t OX;
+        kstring_t BZ;
+        kstring_t RX;
+        kstring_t QX;
+
     public:
         void operator=(Read const &) = delete;
         Read(Read const &) = delete;
         const Platform platform;
         int32_t channel_index;
+        /* row of the read in the observation batch of the decoders or -1 if the read was not prepared */
+        int32_t observation_index;
         uint32_t sample_distance;
         double sample_decoding_confidence;
         uint32_t molecular_distance;
@@ -176,6 +189,7 @@ class Read : public SequenceArray< Segment > {
             raw_molecular_barcode.clear();
             corrected_molecular_barcode.clear();
 
+            observation_index = -1;
             sample_distance = 0;
             sample_decoding_confidence = 1;
             molecular_distance = 0;
@@ -200,26 +214,17 @@ class Read : public SequenceArray< Segment > {
             // if(barcode_decoding_confidence > 0 && barcode_decoding_confidence < 1) {
             //     leader->auxiliary.XO = static_cast< float >(1 - barcode_decoding_confidence);
             // }
+            render_barcode_tags();
             for(auto& segment : this->segment_array) {
-                if(!raw_sample_barcode.empty()) {
-                    raw_sample_barcode.encode_iupac_ambiguity(segment.auxiliary.BC);
-                    raw_sample_barcode.encode_phred_quality(segment.auxiliary.QT, SAM_PHRED_DECODING_OFFSET);
-                }
-                if(!raw_cellular_barcode.empty()) {
-                    raw_cellular_barcode.encode_iupac_ambiguity(segment.auxiliary.CR);
-                    raw_cellular_barcode.encode_phred_quality(segment.auxiliary.CY, SAM_PHRED_DECODING_OFFSET);
-                }
-                if(!corrected_cellular_barcode.empty()) {
-                    corrected_cellular_barcode.encode_iupac_ambiguity(segment.auxiliary.CB);
-                }
-                if(!raw_molecular_barcode.empty()) {
-                    raw_molecular_barcode.encode_iupac_ambiguity(segment.auxiliary.OX);
-                    raw_molecular_barcode.encode_phred_quality(segment.auxiliary.BZ, SAM_PHRED_DECODING_OFFSET);
-                }
-                if(!corrected_molecular_barcode.empty()) {
-                    corrected_molecular_barcode.encode_iupac_ambiguity(segment.auxiliary.RX);
-                    corrected_molecular_barcode.encode_phred_quality(segment.auxiliary.QX, SAM_PHRED_DECODING_OFFSET);
-                }
+                if(ks_not_empty(BC)) ks_put_string(BC, segment.auxiliary.BC);
+                if(ks_not_empty(QT)) ks_put_string(QT, segment.auxiliary.QT);
+                if(ks_not_empty(CR)) ks_put_string(CR, segment.auxiliary.CR);
+                if(ks_not_empty(CY)) ks_put_string(CY, segment.auxiliary.CY);
+                if(ks_not_empty(CB)) ks_put_string(CB, segment.auxiliary.CB);
+                if(ks_not_empty(OX)) ks_put_string(OX, segment.auxiliary.OX);
+                if(ks_not_empty(BZ)) ks_put_string(BZ, segment.auxiliary.BZ);
+                if(ks_not_empty(RX)) ks_put_string(RX, segment.auxiliary.RX);
+                if(ks_not_empty(QX)) ks_put_string(QX, segment.auxiliary.QX);
             }
             if(segment_cardinality() > 1) {
                 for(auto& segment : this->segment_array) {
@@ -350,8 +355,18 @@ class Read : public SequenceArray< Segment > {
         Read(const int32_t& cardinality, const Platform& platform, int32_t leading_segment_index) :
             SequenceArray< Segment >(cardinality),
             leader(&segment_array[leading_segment_index]),
+            BC({ 0, 0, NULL }),
+            QT({ 0, 0, NULL }),
+            CR({ 0, 0, NULL }),
+            CY({ 0, 0, NULL }),
+            CB({ 0, 0, NULL }),
+            OX({ 0, 0, NULL }),
+            BZ({ 0, 0, NULL }),
+            RX({ 0, 0, NULL }),
+            QX({ 0, 0, NULL }),
             platform(platform),
-            channel_index(0) {
+            channel_index(0),
+            observation_index(-1) {
 
             int32_t segment_index(0);
             for(auto& segment : segment_array) {
@@ -375,7 +390,195 @@ class Read : public SequenceArray< Segment > {
                 segment_array.back().set_last_segment(true);
             }
         };
+        ~Read() {
+            ks_free(BC);
+            ks_free(QT);
+            ks_free(CR);
+            ks_free(CY);
+            ks_free(CB);
+            ks_free(OX);
+            ks_free(BZ);
+            ks_free(RX);
+            ks_free(QX);
+        };
+
+    private:
+        inline void render_barcode_tags() {
+            ks_clear(BC);
+            ks_clear(QT);
+            ks_clear(CR);
+            ks_clear(CY);
+            ks_clear(CB);
+            ks_clear(OX);
+            ks_clear(BZ);
+            ks_clear(RX);
+            ks_clear(QX);
+            if(!raw_sample_barcode.empty()) {
+                raw_sample_barcode.encode_iupac_ambiguity(BC);
+                raw_sample_barcode.encode_phred_quality(QT, SAM_PHRED_DECODING_OFFSET);
+            }
+            if(!raw_cellular_barcode.empty()) {
+                raw_cellular_barcode.encode_iupac_ambiguity(CR);
+                raw_cellular_barcode.encode_phred_quality(CY, SAM_PHRED_DECODING_OFFSET);
+            }
+            if(!corrected_cellular_barcode.empty()) {
+                corrected_cellular_barcode.encode_iupac_ambiguity(CB);
+            }
+            if(!raw_molecular_barcode.empty()) {
+                raw_molecular_barcode.encode_iupac_ambiguity(OX);
+                raw_molecular_barcode.encode_phred_quality(BZ, SAM_PHRED_DECODING_OFFSET);
+            }
+            if(!corrected_molecular_barcode.empty()) {
+                corrected_molecular_barcode.encode_iupac_ambiguity(RX);
+                corrected_molecular_barcode.encode_phred_quality(QX, SAM_PHRED_DECODING_OFFSET);
+            }
+        };
 };
 ostream& operator<<(ostream& o, const Read& read);
 
+/*  Observed sequences of a batch of reads laid out as structure of arrays.
+    Every observation segment keeps one allocation with a code plane followed by a quality plane,
+    each holding the bases of consecutive reads stride bytes apart, and a parallel array of lengths.
+    A rule extracts a whole batch into it in one pass per transform and decoders score each read
+    from its row in the planes through an ObservationView. Every row is null terminated
+    and records the read it was extracted from so a decoder can verify the row it was handed. */
+class ObservationBatch {
+    public:
+        void operator=(ObservationBatch const &) = delete;
+        ObservationBatch(ObservationBatch const &) = delete;
+        ObservationBatch(const int32_t& cardinality) :
+            _size(0),
+            _capacity(0),
+            stride_by_segment(cardinality, 0),
+            plane_by_segment(cardinality, NULL),
+            length_by_segment(cardinality) {
+        };
+        ~ObservationBatch() {
+            for(auto& plane : plane_by_segment) {
+                free(plane);
+            }
+        };
+        inline size_t size() const {
+            return _size;
+        };
+        inline size_t segment_cardinality() const {
+            return plane_by_segment.size();
+        };
+        inline int32_t& length(const size_t& segment, const size_t& index) {
+            return length_by_segment[segment][index];
+        };
+        inline const int32_t& length(const size_t& segment, const size_t& index) const {
+            return length_by_segment[segment][index];
+        };
+        inline uint8_t* code(const size_t& segment, const size_t& index) const {
+            return plane_by_segment[segment] + index * stride_by_segment[segment];
+        };
+        inline uint8_t* quality(const size_t& segment, const size_t& index) const {
+            return plane_by_segment[segment] + (_capacity + index) * stride_by_segment[segment];
+        };
+        inline const Read* source(const size_t& index) const {
+            return source_array[index];
+        };
+        inline void set_source(const size_t& index, const Read* source) {
+            source_array[index] = source;
+        };
+
+        /* empty the batch and make room for the lengths of size reads */
+        inline void reset(const size_t& size) {
+            if(size > _capacity) {
+                _capacity = size;
+                for(size_t i(0); i < plane_by_segment.size(); ++i) {
+                    free(plane_by_segment[i]);
+                    plane_by_segment[i] = NULL;
+                    stride_by_segment[i] = 0;
+                    length_by_segment[i].resize(_capacity);
+                }
+                source_array.resize(_capacity, NULL);
+            }
+            _size = size;
+            for(auto& length : length_by_segment) {
+                memset(length.data(), 0, _size * sizeof(int32_t));
+            }
+        };
+
+        /*  once length holds the size every read needs, stride the planes to fit the longest and its
+            terminator and zero the lengths again so they can track the bases as they are written */
+        inline void stride_to_length() {
+            for(size_t i(0); i < plane_by_segment.size(); ++i) {
+                vector< int32_t >& length(length_by_segment[i]);
+                int32_t stride(0);
+                for(size_t index(0); index < _size; ++index) {
+                    if(length[index] > stride) {
+                        stride = length[index];
+                    }
+                }
+                ++stride;
+                if(stride > stride_by_segment[i] || plane_by_segment[i] == NULL) {
+                    kroundup32(stride);
+                    free(plane_by_segment[i]);
+                    if((plane_by_segment[i] = static_cast< uint8_t* >(malloc(2 * _capacity * stride))) == NULL) {
+                        throw OutOfMemoryError();
+                    }
+                    stride_by_segment[i] = stride;
+                }
+                memset(length.data(), 0, _size * sizeof(int32_t));
+            }
+        };
+
+        /* null terminate every row once the bases were written */
+        inline void terminate() {
+            for(size_t i(0); i < plane_by_segment.size(); ++i) {
+                for(size_t index(0); index < _size; ++index) {
+                    code(i, index)[length(i, index)] = '\0';
+                    quality(i, index)[length(i, index)] = '\0';
+                }
+            }
+        };
+
+    private:
+        size_t _size;
+        size_t _capacity;
+        vector< int32_t > stride_by_segment;
+        vector< uint8_t* > plane_by_segment;
+        vector< vector< int32_t > > length_by_segment;
+        vector< const Read* > source_array;
+};
+
+/*  An observation whose segments point at a row in the planes of an ObservationBatch instead of
+    their own buffers, so a decoder scores the row in place. The view is only ever read from.
+    The buffers the segments were constructed with are put back before they are destroyed. */
+class ObservationView : public Observation {
+    public:
+        ObservationView(const int32_t& cardinality) :
+            Observation(cardinality) {
+            code_by_segment.reserve(cardinality);
+            capacity_by_segment.reserve(cardinality);
+            for(const auto& segment : segment_array) {
+                code_by_segment.push_back(segment.code);
+                capacity_by_segment.push_back(segment.capacity);
+            }
+        };
+        ~ObservationView() override {
+            for(size_t i(0); i < segment_array.size(); ++i) {
+                ObservedSequence& segment(segment_array[i]);
+                segment.code = code_by_segment[i];
+                segment.capacity = capacity_by_segment[i];
+                segment.quality = segment.code + segment.capacity;
+            }
+        };
+        inline void bind(const ObservationBatch& batch, const size_t& index) {
+            for(size_t i(0); i < segment_array.size(); ++i) {
+                ObservedSequence& segment(segment_array[i]);
+                segment.code = batch.code(i, index);
+                segment.quality = batch.quality(i, index);
+                segment.length = batch.length(i, index);
+                segment.capacity = segment.length + 1;
+            }
+        };
+
+    private:
+        vector< uint8_t* > code_by_segment;
+        vector< int32_t > capacity_by_segment;
+};
+
 #endif /* PHENIQS_READ_H */
@@ -25,6 +25,7 @@
 #include "include.h"
 #include "json.h"
 #include "phred.h"
+#include "simd.h"
 
 const int32_t INITIAL_SEQUENCE_CAPACITY(64);
 
@@ -87,6 +88,31 @@ class Sequence {
         virtual ~Sequence() {
             free(code);
         };
+
+    protected:
+        /*  a derived sequence can keep further per nucleotide arrays in the same allocation,
+            planes arrays of capacity bytes one after the other starting with code */
+        Sequence(const int32_t& capacity, const int32_t& planes) :
+            code(NULL),
+            capacity(capacity),
+            length(0) {
+            if((code = static_cast< uint8_t* >(malloc(capacity * planes))) == NULL) {
+                throw OutOfMemoryError();
+            }
+            code[length] = '\0';
+        };
+        Sequence(const Sequence& other, const int32_t& planes) :
+            code(NULL),
+            capacity(other.capacity),
+            length(other.length) {
+            if((code = static_cast< uint8_t* >(malloc(capacity * planes))) == NULL) {
+                throw OutOfMemoryError();
+            }
+            memcpy(code, other.code, length);
+            code[length] = '\0';
+        };
+
+    public:
         inline int32_t distance_from(const Sequence& other) const {
             int32_t distance(0);
             for(int32_t i(0); i < length; ++i) {
@@ -99,9 +125,7 @@ class Sequence {
         inline void encode_iupac_ambiguity(kstring_t& buffer) const {
             if(length > 0) {
                 ks_increase_by_size(buffer, length + 2);
-                for(int32_t i(0); i < length; ++i) {
-                    buffer.s[buffer.l + i] = BamToAmbiguousAscii[code[i]];
-                }
+                bam_to_ascii(code, buffer.s + buffer.l, length);
                 buffer.l += length;
                 ks_terminate(buffer);
             }
@@ -111,9 +135,7 @@ class Sequence {
             if((buffer = static_cast< char* >(malloc(length + 1))) == NULL) {
                 throw OutOfMemoryError();
             }
-            for(int32_t i(0); i < length; ++i) {
-                buffer[i] = BamToAmbiguousAscii[code[i]];
-            }
+            bam_to_ascii(code, buffer, length);
             buffer[length] = '\0';
             value.SetString(StringRef(buffer, length));
         };
@@ -128,9 +150,7 @@ class Sequence {
         inline void fill(const char* code, const int32_t& size) {
             if(size > 0) {
                 increase_to_size(size);
-                for(int32_t i(0); i < size; ++i) {
-                    *(this->code + i) = AsciiToAmbiguousBam[static_cast< uint8_t >(code[i])];
-                }
+                ascii_to_bam(code, this->code, size);
             }
             length = size;
             this->code[length] = '\0';
@@ -264,29 +284,16 @@ class ObservedSequence : public Sequence {
     friend ostream& operator<<(ostream& o, const ObservedSequence& sequence);
 
     public:
+        /* quality is stored in the same allocation as code, capacity bytes after it */
         uint8_t* quality;
         inline void increase_to_size(const int32_t& size) override {
             if(size >= capacity) {
-                capacity = size + 1;
-                kroundup32(capacity);
-                if((code = static_cast< uint8_t* >(realloc(code, capacity))) == NULL) {
-                    throw OutOfMemoryError();
-                }
-                if((quality = static_cast< uint8_t* >(realloc(quality, capacity))) == NULL) {
-                    throw OutOfMemoryError();
-                }
+                reallocate(size + 1);
             }
         };
         inline void increase_by_size(const int32_t& size) override {
             if(length + size >= capacity) {
-                capacity = length + size + 1;
-                kroundup32(capacity);
-                if((code = static_cast< uint8_t* >(realloc(code, capacity))) == NULL) {
-                    throw OutOfMemoryError();
-                }
-                if((quality = static_cast< uint8_t* >(realloc(quality, capacity))) == NULL) {
-                    throw OutOfMemoryError();
-                }
+                reallocate(length + size + 1);
             }
         };
         inline void terminate() override {
@@ -299,25 +306,16 @@ class ObservedSequence : public Sequence {
             quality[length] = '\0';
         };
         ObservedSequence(const int32_t& capacity = INITIAL_SEQUENCE_CAPACITY) :
-            Sequence(capacity),
-            quality(NULL) {
-            if((quality = static_cast< uint8_t* >(malloc(capacity))) == NULL) {
-                throw OutOfMemoryError();
-            }
+            Sequence(capacity, 2),
+            quality(code + capacity) {
             quality[length] = '\0';
         };
         ObservedSequence(const ObservedSequence& other) :
-            Sequence(other),
-            quality(NULL) {
-            if((quality = static_cast< uint8_t* >(malloc(capacity))) == NULL) {
-                throw OutOfMemoryError();
-            }
+            Sequence(other, 2),
+            quality(code + capacity) {
             memcpy(quality, other.quality, length);
             quality[length] = '\0';
         };
-        ~ObservedSequence() override {
-            free(quality);
-        };
         inline int32_t masked_distance_from(const Sequence& other, const uint8_t& quality_masking_threshold) const {
             int32_t distance(0);
             for(int32_t i(0); i < length; ++i) {
@@ -352,16 +350,7 @@ class ObservedSequence : public Sequence {
         };
         inline void append(const ObservedSequence& other, const int32_t& start, const int32_t& size) {
             if(size > 0 && start < other.length) {
-                if(length + size >= capacity) {
-                    capacity = length + size + 1;
-                    kroundup32(capacity);
-                    if((code = static_cast< uint8_t* >(realloc(code, capacity))) == NULL) {
-                        throw OutOfMemoryError();
-                    }
-                    if((quality = static_cast< uint8_t* >(realloc(quality, capacity))) == NULL) {
-                        throw OutOfMemoryError();
-                    }
-                }
+                increase_by_size(size);
                 memcpy(code + length, other.code + start, size);
                 memcpy(quality + length, other.quality + start, size);
                 length += size;
@@ -419,9 +408,7 @@ class ObservedSequence : public Sequence {
         inline void encode_phred_quality(kstring_t& buffer, const uint8_t phred_offset) const {
             if(length > 0) {
                 ks_increase_by_size(buffer, length + 2);
-                for(int32_t i(0); i < length; ++i) {
-                    buffer.s[buffer.l + i] = quality[i] + phred_offset;
-                }
+                add_phred_offset(quality, buffer.s + buffer.l, length, phred_offset);
                 buffer.l += length;
                 ks_terminate(buffer);
             }
@@ -434,6 +421,19 @@ class ObservedSequence : public Sequence {
             }
             return *this;
         };
+
+    private:
+        inline void reallocate(int32_t size) {
+            kroundup32(size);
+            if((code = static_cast< uint8_t* >(realloc(code, size * 2))) == NULL) {
+                throw OutOfMemoryError();
+            }
+
+            /* move the quality array to its offset in the larger allocation */
+            memmove(code + size, code + capacity, capacity);
+            capacity = size;
+            quality = code + capacity;
+        };
 };
 ostream& operator<<(ostream& o, const ObservedSequence& sequence);
 
@@ -480,17 +480,6 @@ class Observation : public SequenceArray< ObservedSequence > {
             }
             return sigma;
         };
-        operator string() const {
-            /*  NOTICE this is in BAM encoding not iupac and will not look as expected when printed
-                Used by MDD for exact match */
-            string key;
-            for(const auto& segment : segment_array) {
-                for(int32_t i(0); i < segment.length; ++i) {
-                    key.push_back(segment.code[i]);
-                }
-            }
-            return key;
-        };
 };
 ostream& operator<<(ostream& o, const Observation& observation);
 
@@ -0,0 +1,349 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "simd.h"
+#include "iupac.h"
+
+string to_string(const InstructionSet& value) {
+    string result;
+    switch(value) {
+        case InstructionSet::SCALAR:    result.assign("scalar");    break;
+        case InstructionSet::SSE41:     result.assign("sse4.1");    break;
+        case InstructionSet::AVX2:      result.assign("avx2");      break;
+        default:                                                    break;
+    }
+    return result;
+};
+ostream& operator<<(ostream& o, const InstructionSet& value) {
+    o << to_string(value);
+    return o;
+};
+static InstructionSet detect_instruction_set() {
+    #if defined(PHENIQS_X86_SIMD)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return InstructionSet::AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.1")) {
+        return InstructionSet::SSE41;
+    }
+    #endif
+    return InstructionSet::SCALAR;
+};
+InstructionSet supported_instruction_set() {
+    static const InstructionSet instruction_set(detect_instruction_set());
+    return instruction_set;
+};
+
+/*  ASCII to BAM lookup rows indexed by the low nibble of the character.
+    Characters with a high nibble of 3 are the digits and =, 4 and 6 are the upper and lower case
+    letters A to O and 5 and 7 are P to Z, every other character is translated to N. */
+static const uint8_t ASCII_TO_BAM_DIGIT_ROW[16] = { 1, 2, 4, 8, 15, 15, 15, 15, 15, 15, 15, 15, 15, 0, 15, 15 };
+static const uint8_t ASCII_TO_BAM_LOW_LETTER_ROW[16] = { 15, 1, 14, 2, 13, 15, 15, 4, 11, 15, 15, 12, 15, 3, 15, 15 };
+static const uint8_t ASCII_TO_BAM_HIGH_LETTER_ROW[16] = { 15, 15, 5, 6, 8, 15, 7, 9, 15, 10, 15, 15, 15, 15, 15, 15 };
+
+static inline void ascii_to_bam_scalar(const char* source, uint8_t* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = AsciiToAmbiguousBam[static_cast< uint8_t >(source[i])];
+    }
+};
+static inline void bam_to_ascii_scalar(const uint8_t* source, char* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = BamToAmbiguousAscii[source[i] & 0xf];
+    }
+};
+static inline void pack_nibbles_scalar(const uint8_t* source, uint8_t* target, const size_t length) {
+    size_t i(0);
+    for(; i + 1 < length; i += 2) {
+        target[i >> 1] = static_cast< uint8_t >(source[i] << 4 | source[i + 1]);
+    }
+    if(i < length) {
+        target[i >> 1] = static_cast< uint8_t >(source[i] << 4);
+    }
+};
+static inline void unpack_nibbles_scalar(const uint8_t* source, uint8_t* target, const size_t length) {
+    size_t i(0);
+    for(; i + 1 < length; i += 2) {
+        target[i] = source[i >> 1] >> 4;
+        target[i + 1] = source[i >> 1] & 0xf;
+    }
+    if(i < length) {
+        target[i] = source[i >> 1] >> 4;
+    }
+};
+
+#if defined(PHENIQS_X86_SIMD)
+/*  Every kernel translates whole vectors and finishes with one more vector aligned to the end of the
+    buffer, overlapping bytes already translated, so a read sized buffer needs no scalar tail.
+    Buffers shorter than a vector fall through to the narrower kernel. */
+PHENIQS_TARGET_SSE41 static inline __m128i ascii_to_bam_vector_sse41(const char* source) {
+    const __m128i low_nibble(_mm_set1_epi8(0xf));
+    const __m128i c(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source)));
+    const __m128i low(_mm_and_si128(c, low_nibble));
+    const __m128i high(_mm_and_si128(_mm_srli_epi16(c, 4), low_nibble));
+
+    /* clearing the second bit of the high nibble folds lower case onto upper case */
+    const __m128i folded(_mm_and_si128(high, _mm_set1_epi8(0xd)));
+    __m128i code(_mm_set1_epi8(15));
+    code = _mm_blendv_epi8(code, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_DIGIT_ROW)), low), _mm_cmpeq_epi8(high, _mm_set1_epi8(3)));
+    code = _mm_blendv_epi8(code, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_LOW_LETTER_ROW)), low), _mm_cmpeq_epi8(folded, _mm_set1_epi8(4)));
+    code = _mm_blendv_epi8(code, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_HIGH_LETTER_ROW)), low), _mm_cmpeq_epi8(folded, _mm_set1_epi8(5)));
+    return code;
+};
+PHENIQS_TARGET_SSE41 static void ascii_to_bam_sse41(const char* source, uint8_t* target, const size_t length) {
+    if(length < 16) {
+        ascii_to_bam_scalar(source, target, length);
+    } else {
+        for(size_t i(0); i + 16 < length; i += 16) {
+            _mm_storeu_si128(reinterpret_cast< __m128i* >(target + i), ascii_to_bam_vector_sse41(source + i));
+        }
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(target + length - 16), ascii_to_bam_vector_sse41(source + length - 16));
+    }
+};
+PHENIQS_TARGET_SSE41 static inline __m128i bam_to_ascii_vector_sse41(const uint8_t* source) {
+    const __m128i code(_mm_and_si128(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source)), _mm_set1_epi8(0xf)));
+    return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast< const __m128i* >(BamToAmbiguousAscii)), code);
+};
+PHENIQS_TARGET_SSE41 static void bam_to_ascii_sse41(const uint8_t* source, char* target, const size_t length) {
+    if(length < 16) {
+        bam_to_ascii_scalar(source, target, length);
+    } else {
+        for(size_t i(0); i + 16 < length; i += 16) {
+            _mm_storeu_si128(reinterpret_cast< __m128i* >(target + i), bam_to_ascii_vector_sse41(source + i));
+        }
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(target + length - 16), bam_to_ascii_vector_sse41(source + length - 16));
+    }
+};
+
+/*  Codes are at most 4 bits so a 16 bit lane holding two consecutive codes, the first in the low byte,
+    packs into its low byte by shifting the first up a nibble and the second down a byte.
+    The nibble pack kernels handle the trailing odd code and work in whole bytes of the packed sequence,
+    so the last vector overlaps on a byte boundary. */
+PHENIQS_TARGET_SSE41 static inline __m128i pack_nibbles_vector_sse41(const uint8_t* source) {
+    const __m128i low_byte(_mm_set1_epi16(0xff));
+    const __m128i first(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source)));
+    const __m128i second(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source + 16)));
+    return _mm_packus_epi16 (
+        _mm_and_si128(_mm_or_si128(_mm_slli_epi16(first, 4), _mm_srli_epi16(first, 8)), low_byte),
+        _mm_and_si128(_mm_or_si128(_mm_slli_epi16(second, 4), _mm_srli_epi16(second, 8)), low_byte)
+    );
+};
+PHENIQS_TARGET_SSE41 static void pack_nibbles_sse41(const uint8_t* source, uint8_t* target, const size_t length) {
+    const size_t size(length >> 1);
+    if(size < 16) {
+        pack_nibbles_scalar(source, target, length);
+    } else {
+        for(size_t i(0); i + 16 < size; i += 16) {
+            _mm_storeu_si128(reinterpret_cast< __m128i* >(target + i), pack_nibbles_vector_sse41(source + (i << 1)));
+        }
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(target + size - 16), pack_nibbles_vector_sse41(source + ((size - 16) << 1)));
+        if(length & 1) {
+            target[size] = static_cast< uint8_t >(source[length - 1] << 4);
+        }
+    }
+};
+PHENIQS_TARGET_SSE41 static inline void unpack_nibbles_vector_sse41(const uint8_t* source, uint8_t* target) {
+    const __m128i packed(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source)));
+    const __m128i high(_mm_and_si128(_mm_srli_epi16(packed, 4), _mm_set1_epi8(0xf)));
+    const __m128i low(_mm_and_si128(packed, _mm_set1_epi8(0xf)));
+    _mm_storeu_si128(reinterpret_cast< __m128i* >(target), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast< __m128i* >(target + 16), _mm_unpackhi_epi8(high, low));
+};
+PHENIQS_TARGET_SSE41 static void unpack_nibbles_sse41(const uint8_t* source, uint8_t* target, const size_t length) {
+    const size_t size(length >> 1);
+    if(size < 16) {
+        unpack_nibbles_scalar(source, target, length);
+    } else {
+        for(size_t i(0); i + 16 < size; i += 16) {
+            unpack_nibbles_vector_sse41(source + i, target + (i << 1));
+        }
+        unpack_nibbles_vector_sse41(source + size - 16, target + ((size - 16) << 1));
+        if(length & 1) {
+            target[length - 1] = source[size] >> 4;
+        }
+    }
+};
+
+/*  the byte shuffle looks up each 128 bit lane separately so the rows are repeated in both lanes */
+PHENIQS_TARGET_AVX2 static inline __m256i ascii_to_bam_vector_avx2(const char* source) {
+    const __m256i low_nibble(_mm256_set1_epi8(0xf));
+    const __m256i c(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(source)));
+    const __m256i low(_mm256_and_si256(c, low_nibble));
+    const __m256i high(_mm256_and_si256(_mm256_srli_epi16(c, 4), low_nibble));
+    const __m256i folded(_mm256_and_si256(high, _mm256_set1_epi8(0xd)));
+    __m256i code(_mm256_set1_epi8(15));
+    code = _mm256_blendv_epi8(code, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_DIGIT_ROW))), low), _mm256_cmpeq_epi8(high, _mm256_set1_epi8(3)));
+    code = _mm256_blendv_epi8(code, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_LOW_LETTER_ROW))), low), _mm256_cmpeq_epi8(folded, _mm256_set1_epi8(4)));
+    code = _mm256_blendv_epi8(code, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast< const __m128i* >(ASCII_TO_BAM_HIGH_LETTER_ROW))), low), _mm256_cmpeq_epi8(folded, _mm256_set1_epi8(5)));
+    return code;
+};
+PHENIQS_TARGET_AVX2 static void ascii_to_bam_avx2(const char* source, uint8_t* target, const size_t length) {
+    if(length < 32) {
+        ascii_to_bam_sse41(source, target, length);
+    } else {
+        for(size_t i(0); i + 32 < length; i += 32) {
+            _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + i), ascii_to_bam_vector_avx2(source + i));
+        }
+        _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + length - 32), ascii_to_bam_vector_avx2(source + length - 32));
+    }
+};
+PHENIQS_TARGET_AVX2 static inline __m256i bam_to_ascii_vector_avx2(const uint8_t* source) {
+    const __m256i code(_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(source)), _mm256_set1_epi8(0xf)));
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast< const __m128i* >(BamToAmbiguousAscii))), code);
+};
+PHENIQS_TARGET_AVX2 static void bam_to_ascii_avx2(const uint8_t* source, char* target, const size_t length) {
+    if(length < 32) {
+        bam_to_ascii_sse41(source, target, length);
+    } else {
+        for(size_t i(0); i + 32 < length; i += 32) {
+            _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + i), bam_to_ascii_vector_avx2(source + i));
+        }
+        _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + length - 32), bam_to_ascii_vector_avx2(source + length - 32));
+    }
+};
+
+/*  the byte pack works on each 128 bit lane separately so the 64 bit quarters are put back in order */
+PHENIQS_TARGET_AVX2 static inline __m256i pack_nibbles_vector_avx2(const uint8_t* source) {
+    const __m256i low_byte(_mm256_set1_epi16(0xff));
+    const __m256i first(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(source)));
+    const __m256i second(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(source + 32)));
+    return _mm256_permute4x64_epi64 (
+        _mm256_packus_epi16 (
+            _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(first, 4), _mm256_srli_epi16(first, 8)), low_byte),
+            _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(second, 4), _mm256_srli_epi16(second, 8)), low_byte)
+        ),
+        0xd8
+    );
+};
+PHENIQS_TARGET_AVX2 static void pack_nibbles_avx2(const uint8_t* source, uint8_t* target, const size_t length) {
+    const size_t size(length >> 1);
+    if(size < 32) {
+        pack_nibbles_sse41(source, target, length);
+    } else {
+        for(size_t i(0); i + 32 < size; i += 32) {
+            _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + i), pack_nibbles_vector_avx2(source + (i << 1)));
+        }
+        _mm256_storeu_si256(reinterpret_cast< __m256i* >(target + size - 32), pack_nibbles_vector_avx2(source + ((size - 32) << 1)));
+        if(length & 1) {
+            target[size] = static_cast< uint8_t >(source[length - 1] << 4);
+        }
+    }
+};
+
+/*  widening every packed byte to a 16 bit lane keeps the unpacked codes within the lane */
+PHENIQS_TARGET_AVX2 static inline void unpack_nibbles_vector_avx2(const uint8_t* source, uint8_t* target) {
+    const __m256i packed(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source))));
+    const __m256i code (
+        _mm256_or_si256 (
+            _mm256_srli_epi16(packed, 4),
+            _mm256_slli_epi16(_mm256_and_si256(packed, _mm256_set1_epi16(0xf)), 8)
+        )
+    );
+    _mm256_storeu_si256(reinterpret_cast< __m256i* >(target), code);
+};
+PHENIQS_TARGET_AVX2 static void unpack_nibbles_avx2(const uint8_t* source, uint8_t* target, const size_t length) {
+    const size_t size(length >> 1);
+    if(size < 16) {
+        unpack_nibbles_scalar(source, target, length);
+    } else {
+        for(size_t i(0); i + 16 < size; i += 16) {
+            unpack_nibbles_vector_avx2(source + i, target + (i << 1));
+        }
+        unpack_nibbles_vector_avx2(source + size - 16, target + ((size - 16) << 1));
+        if(length & 1) {
+            target[length - 1] = source[size] >> 4;
+        }
+    }
+};
+#endif
+
+void ascii_to_bam(const char* source, uint8_t* target, const size_t length) {
+    switch(supported_instruction_set()) {
+        #if defined(PHENIQS_X86_SIMD)
+        case InstructionSet::AVX2: {
+            ascii_to_bam_avx2(source, target, length);
+            break;
+        };
+        case InstructionSet::SSE41: {
+            ascii_to_bam_sse41(source, target, length);
+            break;
+        };
+        #endif
+        default: {
+            ascii_to_bam_scalar(source, target, length);
+            break;
+        };
+    }
+};
+void bam_to_ascii(const uint8_t* source, char* target, const size_t length) {
+    switch(supported_instruction_set()) {
+        #if defined(PHENIQS_X86_SIMD)
+        case InstructionSet::AVX2: {
+            bam_to_ascii_avx2(source, target, length);
+            break;
+        };
+        case InstructionSet::SSE41: {
+            bam_to_ascii_sse41(source, target, length);
+            break;
+        };
+        #endif
+        default: {
+            bam_to_ascii_scalar(source, target, length);
+            break;
+        };
+    }
+};
+void pack_nibbles(const uint8_t* source, uint8_t* target, const size_t length) {
+    switch(supported_instruction_set()) {
+        #if defined(PHENIQS_X86_SIMD)
+        case InstructionSet::AVX2: {
+            pack_nibbles_avx2(source, target, length);
+            break;
+        };
+        case InstructionSet::SSE41: {
+            pack_nibbles_sse41(source, target, length);
+            break;
+        };
+        #endif
+        default: {
+            pack_nibbles_scalar(source, target, length);
+            break;
+        };
+    }
+};
+void unpack_nibbles(const uint8_t* source, uint8_t* target, const size_t length) {
+    switch(supported_instruction_set()) {
+        #if defined(PHENIQS_X86_SIMD)
+        case InstructionSet::AVX2: {
+            unpack_nibbles_avx2(source, target, length);
+            break;
+        };
+        case InstructionSet::SSE41: {
+            unpack_nibbles_sse41(source, target, length);
+            break;
+        };
+        #endif
+        default: {
+            unpack_nibbles_scalar(source, target, length);
+            break;
+        };
+    }
+};
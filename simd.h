@@ -0,0 +1,105 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHENIQS_SIMD_H
+#define PHENIQS_SIMD_H
+
+#include "include.h"
+
+/*  SIMD kernels
+
+    Vectorized kernels are compiled with function level target attributes so the binary
+    does not require any particular instruction set on the host. The best instruction set
+    the host supports is detected once at runtime and every kernel has a scalar implementation
+    used when no vector implementation is supported or the platform is not x86.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PHENIQS_X86_SIMD
+#include <immintrin.h>
+#define PHENIQS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define PHENIQS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum class InstructionSet : uint8_t {
+    SCALAR,
+    SSE41,
+    AVX2,
+};
+string to_string(const InstructionSet& value);
+ostream& operator<<(ostream& o, const InstructionSet& value);
+InstructionSet supported_instruction_set();
+
+/*  Nucleotide and quality translation kernels
+
+    Translate between the ASCII IUPAC representation and the 4 bit BAM encoding of nucleotides
+    and between offset ASCII quality and Phred scores. Lookups into the 16 entry nucleotide tables
+    are done with a byte shuffle, 16 or 32 bytes at a time. source and target must not overlap.
+
+    The quality offset is a single packed add that SSE2, part of the x86-64 baseline, already provides.
+    Those kernels are inlined into the caller since a dispatched call on a read sized buffer
+    costs more than the arithmetic.
+*/
+void ascii_to_bam(const char* source, uint8_t* target, const size_t length);
+void bam_to_ascii(const uint8_t* source, char* target, const size_t length);
+
+/*  Pack length 8 bit BAM nucleotide codes into the 4 bit BAM record sequence, two codes to a byte
+    with the first in the high nibble, and unpack them back. An odd trailing code is packed
+    into the high nibble of the last byte and the low nibble is zeroed. */
+void pack_nibbles(const uint8_t* source, uint8_t* target, const size_t length);
+void unpack_nibbles(const uint8_t* source, uint8_t* target, const size_t length);
+inline void subtract_phred_offset(const char* source, uint8_t* target, const size_t length, const uint8_t phred_offset) {
+    size_t i(0);
+    #if defined(PHENIQS_X86_SIMD) && defined(__SSE2__)
+    const __m128i offset(_mm_set1_epi8(static_cast< char >(phred_offset)));
+    if(length >= 16) {
+        for(; i + 16 < length; i += 16) {
+            const __m128i c(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source + i)));
+            _mm_storeu_si128(reinterpret_cast< __m128i* >(target + i), _mm_sub_epi8(c, offset));
+        }
+        const __m128i c(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source + length - 16)));
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(target + length - 16), _mm_sub_epi8(c, offset));
+        return;
+    }
+    #endif
+    for(; i < length; ++i) {
+        target[i] = static_cast< uint8_t >(source[i] - phred_offset);
+    }
+};
+inline void add_phred_offset(const uint8_t* source, char* target, const size_t length, const uint8_t phred_offset) {
+    size_t i(0);
+    #if defined(PHENIQS_X86_SIMD) && defined(__SSE2__)
+    const __m128i offset(_mm_set1_epi8(static_cast< char >(phred_offset)));
+    if(length >= 16) {
+        for(; i + 16 < length; i += 16) {
+            const __m128i q(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source + i)));
+            _mm_storeu_si128(reinterpret_cast< __m128i* >(target + i), _mm_add_epi8(q, offset));
+        }
+        const __m128i q(_mm_loadu_si128(reinterpret_cast< const __m128i* >(source + length - 16)));
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(target + length - 16), _mm_add_epi8(q, offset));
+        return;
+    }
+    #endif
+    for(; i < length; ++i) {
+        target[i] = static_cast< char >(source[i] + phred_offset);
+    }
+};
+
+#endif /* PHENIQS_SIMD_H */
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Pheniqs : PHilology ENcoder wIth Quality Statistics
+# Copyright (C) 2018  Lior Galanti
+# NYU Center for Genetics and System Biology
+
+# Author: Lior Galanti <lior.galanti@nyu.edu>
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Decode a BAM file byte by byte, following the SAM specification rather than htslib,
+# and print it the way htslib formats SAM so it can be compared to a valid SAM output
+
+import sys
+import gzip
+import struct
+
+NUCLEOTIDE = '=ACMGRSVTWYHKDBN'
+CIGAR_OPERATION = 'MIDNSHP=X'
+INTEGER_TYPE = { 'c': '<b', 'C': '<B', 's': '<h', 'S': '<H', 'i': '<i', 'I': '<I' }
+
+def decode_auxiliary(data, position):
+    tag = data[position:position + 2].decode('ascii')
+    code = chr(data[position + 2])
+    position += 3
+    if code == 'A':
+        value = 'A:{}'.format(chr(data[position]))
+        position += 1
+    elif code in INTEGER_TYPE:
+        size = struct.calcsize(INTEGER_TYPE[code])
+        value = 'i:{}'.format(struct.unpack_from(INTEGER_TYPE[code], data, position)[0])
+        position += size
+    elif code == 'f':
+        value = 'f:{:g}'.format(struct.unpack_from('<f', data, position)[0])
+        position += 4
+    elif code == 'Z' or code == 'H':
+        end = data.index(b'\0', position)
+        value = '{}:{}'.format(code, data[position:end].decode('ascii'))
+        position = end + 1
+    elif code == 'B':
+        subtype = chr(data[position])
+        count = struct.unpack_from('<i', data, position + 1)[0]
+        position += 5
+        element = []
+        for i in range(count):
+            if subtype == 'f':
+                element.append('{:g}'.format(struct.unpack_from('<f', data, position)[0]))
+                position += 4
+            else:
+                element.append(str(struct.unpack_from(INTEGER_TYPE[subtype], data, position)[0]))
+                position += struct.calcsize(INTEGER_TYPE[subtype])
+        value = 'B:{}'.format(','.join([subtype] + element))
+    else:
+        raise ValueError('unknown auxiliary type {} in tag {}'.format(code, tag))
+    return '{}:{}'.format(tag, value), position
+
+def decode_record(data, reference):
+    ref_id, pos, l_read_name, mapq, bin, n_cigar, flag, l_seq, next_ref_id, next_pos, tlen = \
+    struct.unpack_from('<iiBBHHHiiii', data, 0)
+    position = 32
+    qname = data[position:position + l_read_name - 1].decode('ascii')
+    position += l_read_name
+    cigar = ''.join(
+        '{}{}'.format(operation >> 4, CIGAR_OPERATION[operation & 0xf])
+        for operation in struct.unpack_from('<{}I'.format(n_cigar), data, position)
+    )
+    position += 4 * n_cigar
+    seq = ''.join(NUCLEOTIDE[(data[position + i // 2] >> (4 * (1 - i % 2))) & 0xf] for i in range(l_seq))
+    position += (l_seq + 1) // 2
+    qual = data[position:position + l_seq]
+    position += l_seq
+    record = [
+        qname,
+        str(flag),
+        reference[ref_id] if ref_id >= 0 else '*',
+        str(pos + 1),
+        str(mapq),
+        cigar if cigar else '*',
+        ('=' if next_ref_id == ref_id else reference[next_ref_id]) if next_ref_id >= 0 else '*',
+        str(next_pos + 1),
+        str(tlen),
+        seq if seq else '*',
+        ''.join(chr(q + 33) for q in qual) if l_seq > 0 and qual[0] != 0xff else '*',
+    ]
+    while position < len(data):
+        tag, position = decode_auxiliary(data, position)
+        record.append(tag)
+    return '\t'.join(record)
+
+def main():
+    with gzip.open(sys.argv[1], 'rb') as file:
+        data = file.read()
+    if data[0:4] != b'BAM\1':
+        raise ValueError('{} is not a BAM file'.format(sys.argv[1]))
+    l_text = struct.unpack_from('<i', data, 4)[0]
+    text = data[8:8 + l_text].rstrip(b'\0').decode('ascii')
+    position = 8 + l_text
+    n_ref = struct.unpack_from('<i', data, position)[0]
+    position += 4
+    reference = []
+    for i in range(n_ref):
+        l_name = struct.unpack_from('<i', data, position)[0]
+        reference.append(data[position + 4:position + 4 + l_name - 1].decode('ascii'))
+        position += 8 + l_name
+    sys.stdout.write(text)
+    while position < len(data):
+        block_size = struct.unpack_from('<i', data, position)[0]
+        sys.stdout.write(decode_record(data[position + 4:position + 4 + block_size], reference))
+        sys.stdout.write('\n')
+        position += 4 + block_size
+
+if __name__ == '__main__':
+    main()
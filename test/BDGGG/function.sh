@@ -46,6 +46,103 @@ make_valid_test() {
     remove_polymorphic $PHENIQS_VALID_STDERR
 }
 
+remove_decoding_confidence() {
+    # decoding error probabilities are only guaranteed to agree within the pruning tolerance
+    PHENIQS_DOCUMENT_PATH="$1"
+    cat $PHENIQS_DOCUMENT_PATH | \
+    sed -E 's/\t(XB|XM|XC):f:[^\t]*//g' \
+    > "$PHENIQS_DOCUMENT_PATH.tmp"
+    mv "$PHENIQS_DOCUMENT_PATH.tmp" "$PHENIQS_DOCUMENT_PATH"
+}
+
+run_equivalence_test() {
+    # compare the output of a configuration to the valid output of an equivalent configuration
+    PHENIQS_TEST_HOME="$1"
+    PHENIQS_TEST_NAME="$2"
+    PHENIQS_VALID_NAME="$3"
+    PHENIQS_TEST_COMMAND="$4"
+
+    PHENIQS_TEST_STDOUT="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.out"
+    PHENIQS_TEST_STDERR="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.err"
+    PHENIQS_VALID_STDOUT="$PHENIQS_TEST_HOME/result/$PHENIQS_VALID_NAME.valid.out"
+
+    # execute
+    $PHENIQS_BIN $PHENIQS_TEST_COMMAND > $PHENIQS_TEST_STDOUT 2> $PHENIQS_TEST_STDERR
+    PHENIQS_TEST_RETURN_CODE=$?
+    if [ "$PHENIQS_TEST_RETURN_CODE" == "0" ]; then
+        cp "$PHENIQS_TEST_HOME/valid/$PHENIQS_VALID_NAME.out" $PHENIQS_VALID_STDOUT
+        remove_polymorphic $PHENIQS_TEST_STDOUT
+        remove_decoding_confidence $PHENIQS_TEST_STDOUT
+        remove_decoding_confidence $PHENIQS_VALID_STDOUT
+        if [ "$(diff -q $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT)" ]; then
+            printf "$PHENIQS_TEST_NAME : Pheniqs stdout differs from $PHENIQS_VALID_NAME\n";
+            diff $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT
+            return 1
+        fi
+    else
+        printf "Pheniqs returned $PHENIQS_TEST_RETURN_CODE\n";
+        return $PHENIQS_TEST_RETURN_CODE
+    fi
+}
+
+run_output_test() {
+    # compare only the output of a configuration to the valid output,
+    # the report on stderr carries statistics specific to the decoding configuration
+    PHENIQS_TEST_HOME="$1"
+    PHENIQS_TEST_NAME="$2"
+    PHENIQS_VALID_NAME="$3"
+    PHENIQS_TEST_COMMAND="$4"
+
+    PHENIQS_TEST_STDOUT="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.out"
+    PHENIQS_TEST_STDERR="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.err"
+    PHENIQS_VALID_STDOUT="$PHENIQS_TEST_HOME/valid/$PHENIQS_VALID_NAME.out"
+
+    # execute
+    $PHENIQS_BIN $PHENIQS_TEST_COMMAND > $PHENIQS_TEST_STDOUT 2> $PHENIQS_TEST_STDERR
+    PHENIQS_TEST_RETURN_CODE=$?
+    if [ "$PHENIQS_TEST_RETURN_CODE" == "0" ]; then
+        remove_polymorphic $PHENIQS_TEST_STDOUT
+        if [ "$(diff -q $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT)" ]; then
+            printf "$PHENIQS_TEST_NAME : Pheniqs stdout differs from $PHENIQS_VALID_NAME\n";
+            diff $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT
+            return 1
+        fi
+    else
+        printf "Pheniqs returned $PHENIQS_TEST_RETURN_CODE\n";
+        return $PHENIQS_TEST_RETURN_CODE
+    fi
+}
+
+run_bam_test() {
+    # write the output of a configuration to BAM and compare the records,
+    # decoded without htslib, to the valid SAM output of the same configuration
+    PHENIQS_TEST_HOME="$1"
+    PHENIQS_TEST_NAME="$2"
+    PHENIQS_VALID_NAME="$3"
+    PHENIQS_TEST_COMMAND="$4"
+
+    PHENIQS_TEST_BAM="$PWD/$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.bam"
+    PHENIQS_TEST_STDOUT="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.out"
+    PHENIQS_TEST_STDERR="$PHENIQS_TEST_HOME/result/$PHENIQS_TEST_NAME.err"
+    PHENIQS_VALID_STDOUT="$PHENIQS_TEST_HOME/valid/$PHENIQS_VALID_NAME.out"
+
+    # execute
+    $PHENIQS_BIN $PHENIQS_TEST_COMMAND --output $PHENIQS_TEST_BAM > /dev/null 2> $PHENIQS_TEST_STDERR
+    PHENIQS_TEST_RETURN_CODE=$?
+    if [ "$PHENIQS_TEST_RETURN_CODE" == "0" ]; then
+        python3 "$PHENIQS_TEST_HOME/bam_to_sam.py" $PHENIQS_TEST_BAM > $PHENIQS_TEST_STDOUT || return 1
+        remove_polymorphic $PHENIQS_TEST_STDOUT
+        if [ "$(diff -q $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT)" ]; then
+            printf "$PHENIQS_TEST_NAME : BAM records differ from $PHENIQS_VALID_NAME\n";
+            diff $PHENIQS_VALID_STDOUT $PHENIQS_TEST_STDOUT
+            return 1
+        fi
+    else
+        printf "Pheniqs returned $PHENIQS_TEST_RETURN_CODE\n";
+        return $PHENIQS_TEST_RETURN_CODE
+    fi
+}
+
 run_test() {
     PHENIQS_TEST_HOME="$1"
     PHENIQS_TEST_NAME="$2"
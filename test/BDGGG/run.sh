@@ -81,4 +81,54 @@ else
   printf "BDGGG annotated passed\n";
 fi
 
+run_equivalence_test $PHENIQS_TEST_HOME "annotated_pruning" "annotated" \
+"mux --config test/BDGGG/BDGGG_annotated_pruning.json --precision $PHENIQS_PRECISION"
+PHENIQS_TEST_RETURN_CODE="$?"
+if [ "$PHENIQS_TEST_RETURN_CODE" != "0" ]; then
+    printf "annotated_pruning failed with code $PHENIQS_TEST_RETURN_CODE\n";
+    exit $PHENIQS_TEST_RETURN_CODE;
+else
+  printf "BDGGG annotated pruning passed\n";
+fi
+
+run_equivalence_test $PHENIQS_TEST_HOME "annotated_log_space" "annotated" \
+"mux --config test/BDGGG/BDGGG_annotated_log_space.json --precision $PHENIQS_PRECISION"
+PHENIQS_TEST_RETURN_CODE="$?"
+if [ "$PHENIQS_TEST_RETURN_CODE" != "0" ]; then
+    printf "annotated_log_space failed with code $PHENIQS_TEST_RETURN_CODE\n";
+    exit $PHENIQS_TEST_RETURN_CODE;
+else
+  printf "BDGGG annotated log space passed\n";
+fi
+
+run_output_test $PHENIQS_TEST_HOME "annotated_cache" "annotated" \
+"mux --config test/BDGGG/BDGGG_annotated_cache.json --precision $PHENIQS_PRECISION"
+PHENIQS_TEST_RETURN_CODE="$?"
+if [ "$PHENIQS_TEST_RETURN_CODE" != "0" ]; then
+    printf "annotated_cache failed with code $PHENIQS_TEST_RETURN_CODE\n";
+    exit $PHENIQS_TEST_RETURN_CODE;
+else
+  printf "BDGGG annotated cache passed\n";
+fi
+
+run_output_test $PHENIQS_TEST_HOME "mdd" "mdd" \
+"mux --config test/BDGGG/BDGGG_mdd.json --precision $PHENIQS_PRECISION"
+PHENIQS_TEST_RETURN_CODE="$?"
+if [ "$PHENIQS_TEST_RETURN_CODE" != "0" ]; then
+    printf "mdd failed with code $PHENIQS_TEST_RETURN_CODE\n";
+    exit $PHENIQS_TEST_RETURN_CODE;
+else
+  printf "BDGGG mdd passed\n";
+fi
+
+run_bam_test $PHENIQS_TEST_HOME "annotated_bam" "annotated" \
+"mux --config test/BDGGG/BDGGG_annotated.json --precision $PHENIQS_PRECISION"
+PHENIQS_TEST_RETURN_CODE="$?"
+if [ "$PHENIQS_TEST_RETURN_CODE" != "0" ]; then
+    printf "annotated_bam failed with code $PHENIQS_TEST_RETURN_CODE\n";
+    exit $PHENIQS_TEST_RETURN_CODE;
+else
+  printf "BDGGG annotated BAM passed\n";
+fi
+
 exit 0
@@ -0,0 +1,155 @@
+/*
+    Pheniqs : PHilology ENcoder wIth Quality Statistics
+    Copyright (C) 2018  Lior Galanti
+    NYU Center for Genetics and System Biology
+
+    Author: Lior Galanti <lior.galanti@nyu.edu>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*  Micro benchmark for the nucleotide, nibble packing and quality translation kernels in simd.h
+
+    Each kernel is timed against the equivalent byte at a time table lookup on a buffer of random
+    read sized chunks and the output of both is compared. Reports throughput in MB/s and the speedup.
+*/
+
+#include "include.h"
+#include "iupac.h"
+#include "simd.h"
+
+#include <chrono>
+#include <random>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::mt19937;
+using std::uniform_int_distribution;
+
+const size_t BENCHMARK_BUFFER_SIZE(1 << 20);
+const size_t BENCHMARK_CHUNK_SIZE(151);
+const int32_t BENCHMARK_REPEAT(200);
+const uint8_t BENCHMARK_PHRED_OFFSET(33);
+
+static void ascii_to_bam_reference(const char* source, uint8_t* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = AsciiToAmbiguousBam[static_cast< uint8_t >(source[i])];
+    }
+};
+static void bam_to_ascii_reference(const uint8_t* source, char* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = BamToAmbiguousAscii[source[i]];
+    }
+};
+static void subtract_phred_offset_reference(const char* source, uint8_t* target, const size_t length, const uint8_t phred_offset) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = source[i] - phred_offset;
+    }
+};
+static void pack_nibbles_reference(const uint8_t* source, uint8_t* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i >> 1] = (target[i >> 1] & 0xf << ((i & 1) << 2)) | source[i] << ((~i & 1) << 2);
+    }
+};
+static void unpack_nibbles_reference(const uint8_t* source, uint8_t* target, const size_t length) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = source[i >> 1] >> ((~i & 1) << 2) & 0xf;
+    }
+};
+static void add_phred_offset_reference(const uint8_t* source, char* target, const size_t length, const uint8_t phred_offset) {
+    for(size_t i(0); i < length; ++i) {
+        target[i] = source[i] + phred_offset;
+    }
+};
+
+/*  Offset of a chunk on the packed side of the nibble kernels, every chunk takes whole bytes */
+static inline size_t packed_offset(const size_t& offset) {
+    return (offset / BENCHMARK_CHUNK_SIZE) * ((BENCHMARK_CHUNK_SIZE + 1) >> 1);
+};
+
+/*  Time the kernel over the whole buffer in read sized chunks, the way the feeds call it */
+template < typename S, typename T, typename F > static double measure(const S* source, T* target, F kernel, const bool source_packed = false, const bool target_packed = false) {
+    auto start(steady_clock::now());
+    for(int32_t repeat(0); repeat < BENCHMARK_REPEAT; ++repeat) {
+        for(size_t offset(0); offset < BENCHMARK_BUFFER_SIZE; offset += BENCHMARK_CHUNK_SIZE) {
+            kernel (
+                source + (source_packed ? packed_offset(offset) : offset),
+                target + (target_packed ? packed_offset(offset) : offset),
+                min(BENCHMARK_CHUNK_SIZE, BENCHMARK_BUFFER_SIZE - offset)
+            );
+        }
+    }
+    double elapsed(duration< double >(steady_clock::now() - start).count());
+    return (static_cast< double >(BENCHMARK_BUFFER_SIZE) * BENCHMARK_REPEAT) / (elapsed * 1e6);
+};
+static void report(const string& name, const double& reference, const double& vectorized, const bool& identical) {
+    cout << setw(24) << left << name;
+    cout << setw(12) << right << fixed << setprecision(1) << reference;
+    cout << setw(12) << right << fixed << setprecision(1) << vectorized;
+    cout << setw(10) << right << fixed << setprecision(2) << vectorized / reference << "x";
+    cout << (identical ? "" : "  MISMATCH") << endl;
+};
+
+int main() {
+    mt19937 generator(0);
+    uniform_int_distribution< int > nucleotide(0, 4);
+    uniform_int_distribution< int > quality(0, 41);
+
+    vector< char > ascii(BENCHMARK_BUFFER_SIZE);
+    vector< char > phred(BENCHMARK_BUFFER_SIZE);
+    vector< uint8_t > code(BENCHMARK_BUFFER_SIZE);
+    vector< uint8_t > score(BENCHMARK_BUFFER_SIZE);
+    vector< uint8_t > reference_code(BENCHMARK_BUFFER_SIZE);
+    vector< char > reference_ascii(BENCHMARK_BUFFER_SIZE);
+    vector< char > vectorized_ascii(BENCHMARK_BUFFER_SIZE);
+    vector< uint8_t > packed(BENCHMARK_BUFFER_SIZE);
+    vector< uint8_t > reference_packed(BENCHMARK_BUFFER_SIZE);
+    for(size_t i(0); i < BENCHMARK_BUFFER_SIZE; ++i) {
+        ascii[i] = "ACGTN"[nucleotide(generator)];
+        phred[i] = static_cast< char >(quality(generator) + BENCHMARK_PHRED_OFFSET);
+    }
+
+    cout << "Instruction set " << supported_instruction_set() << endl;
+    cout << setw(24) << left << "Kernel";
+    cout << setw(12) << right << "scalar MB/s";
+    cout << setw(12) << right << "simd MB/s";
+    cout << setw(11) << right << "speedup" << endl;
+
+    double reference(measure(ascii.data(), reference_code.data(), ascii_to_bam_reference));
+    double vectorized(measure(ascii.data(), code.data(), ascii_to_bam));
+    report("ascii_to_bam", reference, vectorized, code == reference_code);
+
+    reference = measure(code.data(), reference_ascii.data(), bam_to_ascii_reference);
+    vectorized = measure(code.data(), vectorized_ascii.data(), bam_to_ascii);
+    report("bam_to_ascii", reference, vectorized, vectorized_ascii == reference_ascii && vectorized_ascii == ascii);
+
+    /* the chunk size is odd so every chunk ends in a half byte */
+    reference = measure(code.data(), reference_packed.data(), pack_nibbles_reference, false, true);
+    vectorized = measure(code.data(), packed.data(), pack_nibbles, false, true);
+    report("pack_nibbles", reference, vectorized, packed == reference_packed);
+
+    reference = measure(packed.data(), reference_code.data(), unpack_nibbles_reference, true, false);
+    vectorized = measure(packed.data(), score.data(), unpack_nibbles, true, false);
+    report("unpack_nibbles", reference, vectorized, score == reference_code && score == code);
+
+    reference = measure(phred.data(), reference_code.data(), [](const char* s, uint8_t* t, size_t l) { subtract_phred_offset_reference(s, t, l, BENCHMARK_PHRED_OFFSET); });
+    vectorized = measure(phred.data(), score.data(), [](const char* s, uint8_t* t, size_t l) { subtract_phred_offset(s, t, l, BENCHMARK_PHRED_OFFSET); });
+    report("subtract_phred_offset", reference, vectorized, score == reference_code);
+
+    reference = measure(score.data(), reference_ascii.data(), [](const uint8_t* s, char* t, size_t l) { add_phred_offset_reference(s, t, l, BENCHMARK_PHRED_OFFSET); });
+    vectorized = measure(score.data(), vectorized_ascii.data(), [](const uint8_t* s, char* t, size_t l) { add_phred_offset(s, t, l, BENCHMARK_PHRED_OFFSET); });
+    report("add_phred_offset", reference, vectorized, vectorized_ascii == reference_ascii && vectorized_ascii == phred);
+
+    return 0;
+};
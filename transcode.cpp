@@ -42,6 +42,25 @@ TranscodingDecoder::TranscodingDecoder(const Value& ontology) try :
         error.push("TranscodingDecoder");
         throw;
 };
+TranscodingDecoder::TranscodingDecoder(const TranscodingDecoder& other) :
+    count(0),
+    pf_count(0),
+    pf_fraction(0),
+    sample_classifier(NULL) {
+
+    /* copies share the read only tables the classifiers of other built when they were loaded */
+    if(other.sample_classifier != NULL) {
+        sample_classifier = copy_classifier(*other.sample_classifier);
+    }
+    molecular_classifier_array.reserve(other.molecular_classifier_array.size());
+    for(const auto classifier : other.molecular_classifier_array) {
+        molecular_classifier_array.push_back(copy_classifier(*classifier));
+    }
+    cellular_classifier_array.reserve(other.cellular_classifier_array.size());
+    for(const auto classifier : other.cellular_classifier_array) {
+        cellular_classifier_array.push_back(copy_classifier(*classifier));
+    }
+};
 TranscodingDecoder::~TranscodingDecoder() {
     if(sample_classifier != NULL) {
         delete sample_classifier;
@@ -57,6 +76,32 @@ TranscodingDecoder::~TranscodingDecoder() {
         }
     }
 };
+Classifier< Barcode >* TranscodingDecoder::copy_classifier(const Classifier< Barcode >& other) const {
+    if(const PamlSampleDecoder* decoder = dynamic_cast< const PamlSampleDecoder* >(&other)) {
+        return new PamlSampleDecoder(*decoder);
+
+    } else if(const PamlMolecularDecoder* decoder = dynamic_cast< const PamlMolecularDecoder* >(&other)) {
+        return new PamlMolecularDecoder(*decoder);
+
+    } else if(const PamlCellularDecoder* decoder = dynamic_cast< const PamlCellularDecoder* >(&other)) {
+        return new PamlCellularDecoder(*decoder);
+
+    } else if(const MdSampleDecoder* decoder = dynamic_cast< const MdSampleDecoder* >(&other)) {
+        return new MdSampleDecoder(*decoder);
+
+    } else if(const MdMolecularDecoder* decoder = dynamic_cast< const MdMolecularDecoder* >(&other)) {
+        return new MdMolecularDecoder(*decoder);
+
+    } else if(const MdCellularDecoder* decoder = dynamic_cast< const MdCellularDecoder* >(&other)) {
+        return new MdCellularDecoder(*decoder);
+
+    } else if(const NaiveMolecularDecoder* decoder = dynamic_cast< const NaiveMolecularDecoder* >(&other)) {
+        return new NaiveMolecularDecoder(*decoder);
+
+    } else {
+        return new Classifier< Barcode >(other);
+    }
+};
 void TranscodingDecoder::load_sample_decoding(const Value& ontology) {
     Value::ConstMemberIterator reference = ontology.FindMember("sample");
     if(reference != ontology.MemberEnd()) {
@@ -229,6 +274,43 @@ void TranscodingDecoder::encode(Value& container, Document& document) const {
         container.AddMember("cellular", array.Move(), document.GetAllocator());
     }
 };
+static Value encode_classifier_progress(const Classifier< Barcode >& classifier, const uint64_t& unclassified_count, const uint64_t& decoded_count, Document& document) {
+    Value element(kObjectType);
+    const uint64_t classified_count(decoded_count > unclassified_count ? decoded_count - unclassified_count : 0);
+    encode_key_value("index", classifier.index, element, document);
+    encode_key_value("classified count", classified_count, element, document);
+    encode_key_value("unclassified count", unclassified_count, element, document);
+    if(decoded_count > 0) {
+        encode_key_value("classified fraction", double(classified_count) / double(decoded_count), element, document);
+    }
+    return element;
+};
+void TranscodingDecoder::encode_progress(const vector< uint64_t >& unclassified_count_by_classifier, const uint64_t& decoded_count, Value& container, Document& document) const {
+    /* unclassified counts are in the order the classifiers are published */
+    size_t index(0);
+    if(sample_classifier != NULL) {
+        Value element(encode_classifier_progress(*sample_classifier, unclassified_count_by_classifier[index++], decoded_count, document));
+        container.AddMember("sample", element.Move(), document.GetAllocator());
+    }
+
+    if(!molecular_classifier_array.empty()) {
+        Value array(kArrayType);
+        for(auto& classifier : molecular_classifier_array) {
+            Value element(encode_classifier_progress(*classifier, unclassified_count_by_classifier[index++], decoded_count, document));
+            array.PushBack(element.Move(), document.GetAllocator());
+        }
+        container.AddMember("molecular", array.Move(), document.GetAllocator());
+    }
+
+    if(!cellular_classifier_array.empty()) {
+        Value array(kArrayType);
+        for(auto& classifier : cellular_classifier_array) {
+            Value element(encode_classifier_progress(*classifier, unclassified_count_by_classifier[index++], decoded_count, document));
+            array.PushBack(element.Move(), document.GetAllocator());
+        }
+        container.AddMember("cellular", array.Move(), document.GetAllocator());
+    }
+};
 
 /* Transcode */
 
@@ -257,11 +339,12 @@ Transcode::Transcode(Document& operation) try :
     count(0),
     pf_count(0),
     pf_fraction(0),
-    end_of_input(false),
     decoded_nucleotide_cardinality(0),
     thread_pool({NULL, 0}),
+    next_input_ordinal(0),
     multiplexer(NULL),
-    transcoding_decoder(NULL) {
+    transcoding_decoder(NULL),
+    progressing(false) {
 
     } catch(Error& error) {
         error.push("Transcode");
@@ -271,6 +354,10 @@ Transcode::~Transcode() {
     if(thread_pool.pool != NULL) {
         hts_tpool_destroy(thread_pool.pool);
     }
+
+    /*  the output stages of the transcoding threads hold records placed in the arena of their feed */
+    transcoding_thread_by_index.clear();
+
     for(auto feed : input_feed_by_index) {
         delete feed;
     }
@@ -284,39 +371,69 @@ Transcode::~Transcode() {
     delete multiplexer;
     delete transcoding_decoder;
 };
-bool Transcode::pull(Read& read) {
-    vector< unique_lock< mutex > > feed_locks;
-    feed_locks.reserve(input_feed_by_index.size());
-
-    /* acquire a pull lock for all input feeds in a fixed order */
-    for(const auto feed : input_feed_by_index) {
-        feed_locks.push_back(feed->acquire_pull_lock());
-    }
+int32_t Transcode::pull_batch(list< Read >& batch) {
+    /*  claim a contiguous range of read ordinals for the entire batch with a single atomic increment
+        and pull every segment of every read, returns the number of reads pulled which is only
+        smaller than the batch size when the input is exhausted. The records are released once
+        for every slot the batch spans so the slot counters are updated once per slot and not per read */
+    const int64_t first(next_input_ordinal.fetch_add(static_cast< int64_t >(batch.size()), std::memory_order_relaxed));
+    int32_t pulled(0);
+    int64_t ordinal(first);
+    for(auto& read : batch) {
+        size_t available(0);
+        size_t missing(0);
+        for(size_t i(0); i < read.segment_cardinality(); ++i) {
+            if(input_feed_by_segment[i]->pull(ordinal, input_record_by_segment[i], read[i])) {
+                ++available;
+            } else {
+                missing = i;
+            }
+        }
+        if(available == read.segment_cardinality()) {
+            ++pulled;
+            ++ordinal;
 
-    /* pull into input read from input feeds */
-    for(size_t i(0); i < read.segment_cardinality(); ++i) {
-        if(!input_feed_by_segment[i]->pull(read[i])) {
-            end_of_input = true;
+            /* a slot is released as soon as the batch moves past it so a batch can span more slots than the ring holds */
+            for(size_t i(0); i < input_feed_by_segment.size(); ++i) {
+                const int64_t batch_size(input_feed_by_segment[i]->batch_size());
+                if(ordinal % batch_size == 0) {
+                    input_feed_by_segment[i]->release(max(first, ordinal - batch_size), ordinal);
+                }
+            }
+        } else {
+            if(available > 0) {
+                throw_mismatched_input(ordinal, missing);
+            }
+            break;
         }
     }
-
-    /* update input counters */
-    if(!end_of_input) {
-        ++count;
-        if(!read.qcfail()) {
-            ++pf_count;
+    for(size_t i(0); i < input_feed_by_segment.size(); ++i) {
+        const int64_t begin(max(first, ordinal - ordinal % input_feed_by_segment[i]->batch_size()));
+        if(begin < ordinal) {
+            input_feed_by_segment[i]->release(begin, ordinal);
         }
     }
-
-    /* release the locks on the input feeds in reverse order */
-    for(auto feed_lock(feed_locks.rbegin()); feed_lock != feed_locks.rend(); ++feed_lock) {
-        feed_lock->unlock();
+    return pulled;
+};
+void Transcode::halt_input() {
+    for(auto feed : input_feed_by_index) {
+        feed->stop();
     }
-    return !end_of_input;
+};
+void Transcode::throw_mismatched_input(const int64_t& ordinal, const size_t& segment_index) {
+    /*  the read was only pulled from some of the input feeds, its records are never released
+        so the input feeds are stopped before another thread waits on a slot holding them */
+    halt_input();
+    throw SequenceError(
+        "input segment " + to_string(segment_index) +
+        " in " + string(input_feed_by_segment[segment_index]->url) +
+        " ended after " + to_string(ordinal) +
+        " reads while other input segments have more reads");
 };
 void Transcode::collect(const TranscodingThread& transcoding_thread) {
+    count += transcoding_thread.input_count;
+    pf_count += transcoding_thread.input_pf_count;
     transcoding_decoder->collect(transcoding_thread.transcoding_decoder);
-    multiplexer->collect(transcoding_thread.multiplexer);
 };
 
 /* assemble */
@@ -1267,6 +1384,10 @@ void Transcode::compile_output() {
     standardize_url_value_by_key("report url", ontology, ontology, IoDirection::OUT);
     relocate_url_by_key("report url", ontology, ontology, base_output);
 
+    /* expand the progress report URL */
+    standardize_url_value_by_key("progress url", ontology, ontology, IoDirection::OUT);
+    relocate_url_by_key("progress url", ontology, ontology, base_output);
+
     /* expand the prior adjusted job URL */
     standardize_url_value_by_key("prior adjusted job url", ontology, ontology, IoDirection::OUT);
     relocate_url_by_key("prior adjusted job url", ontology, ontology, base_output);
@@ -1482,6 +1603,18 @@ void Transcode::cross_validate_io() {
             throw ConfigurationError("URL " + string(report_url) + " can not be used for both output and report");
         }
     }
+    URL progress_url;
+    if(decode_value_by_key< URL >("progress url", progress_url, ontology) && !progress_url.is_dev_null()) {
+        if(input_url_set.count(progress_url) > 0) {
+            throw ConfigurationError("URL " + string(progress_url) + " can not be used for both input and progress report");
+        }
+        if(output_url_set.count(progress_url) > 0) {
+            throw ConfigurationError("URL " + string(progress_url) + " can not be used for both output and progress report");
+        }
+        if(progress_url == report_url) {
+            throw ConfigurationError("URL " + string(progress_url) + " can not be used for both report and progress report");
+        }
+    }
     for(auto& url : output_url_set) {
         if(input_url_set.count(url) > 0) {
             throw ConfigurationError("URL " + string(url.path()) + " is used for both input and output");
@@ -1554,6 +1687,27 @@ void Transcode::validate_decoder(Value& value) {
                 }
             }
 
+            int32_t pruning_distance;
+            if(decode_value_by_key< int32_t >("pruning distance", pruning_distance, value)) {
+                if(pruning_distance < 0) {
+                    throw ConfigurationError("pruning distance value " + to_string(pruning_distance) + " is negative");
+                }
+            }
+
+            double pruning_tolerance;
+            if(decode_value_by_key< double >("pruning tolerance", pruning_tolerance, value)) {
+                if(pruning_tolerance < 0 || pruning_tolerance >= 1) {
+                    throw ConfigurationError("pruning tolerance value " + to_string(pruning_tolerance) + " not between 0 and 1");
+                }
+            }
+
+            vector< uint8_t > cache_quality_bins;
+            if(decode_value_by_key< vector< uint8_t > >("cache quality bins", cache_quality_bins, value)) {
+                if(cache_quality_bins.size() > MAX_CACHE_QUALITY_BIN_CARDINALITY) {
+                    throw ConfigurationError("cache quality bins can not have more than " + to_string(MAX_CACHE_QUALITY_BIN_CARDINALITY) + " values");
+                }
+            }
+
             uint8_t corrected_quality;
             if(decode_value_by_key< uint8_t >("corrected quality", corrected_quality, value)) {
                 if(corrected_quality < MIN_PHRED_VALUE || corrected_quality > MAX_PHRED_VALUE) {
@@ -1595,6 +1749,12 @@ void Transcode::validate_url_accessibility() {
             }
         }
     }
+
+    if(decode_value_by_key< URL >("progress url", url, ontology)) {
+        if(!url.is_writable()) {
+            throw IOError("can not open " + string(url.path()) + " for writing progress report");
+        }
+    }
 };
 void Transcode::load_thread_pool() {
     if(thread_pool.pool == NULL) {
@@ -1657,6 +1817,14 @@ void Transcode::load_input() {
             }
         }
     }
+
+    /*  Populate input_record_by_segment, the position of each segment in the interleaved records of its feed */
+    unordered_map< Feed*, int32_t > record_by_feed;
+    input_record_by_segment.clear();
+    input_record_by_segment.reserve(input_feed_by_segment.size());
+    for(auto& feed : input_feed_by_segment) {
+        input_record_by_segment.push_back(record_by_feed[feed]++);
+    }
 };
 void Transcode::load_output() {
     /*  Decode feed_proxy_array, a local list of output feed proxy.
@@ -1769,6 +1937,7 @@ void Transcode::load_output() {
 void Transcode::load_decoding() {
     transcoding_decoder = new TranscodingDecoder(ontology);
     int32_t decoding_threads(decode_value_by_key< int32_t >("decoding threads", ontology));
+    multiplexer->load_accumulator_shard(decoding_threads);
     for(int32_t index(0); index < decoding_threads; ++index) {
         transcoding_thread_by_index.emplace_back(*this, index);
     }
@@ -1786,12 +1955,150 @@ void Transcode::start() {
     for(auto feed : output_feed_by_index) {
         feed->start();
     }
+    #if defined(PHENIQS_STAGE_PROFILE)
+    profile_begin = std::chrono::steady_clock::now();
+    profile_begin_cycles = read_cycle_counter();
+    #endif
     for(auto& transcoding_thread : transcoding_thread_by_index) {
         transcoding_thread.start();
     }
+    start_progress();
     for(auto& transcoding_thread : transcoding_thread_by_index) {
         transcoding_thread.join();
     }
+    #if defined(PHENIQS_STAGE_PROFILE)
+    profile_end_cycles = read_cycle_counter();
+    profile_end = std::chrono::steady_clock::now();
+    #endif
+    stop_progress();
+};
+void Transcode::start_progress() {
+    URL progress_url;
+    if(decode_value_by_key< URL >("progress url", progress_url, ontology)) {
+        progressing = true;
+        progress_thread = thread(&Transcode::run_progress, this);
+    }
+};
+void Transcode::stop_progress() {
+    if(progress_thread.joinable()) {
+        {
+            lock_guard< mutex > progress_lock(progress_mutex);
+            progressing = false;
+        }
+        progress_stopped.notify_one();
+        progress_thread.join();
+    }
+};
+void Transcode::run_progress() {
+    /* sample the counters published by the transcoding threads every interval until they all joined */
+    const int32_t progress_interval(decode_value_by_key< int32_t >("progress interval", ontology));
+    const std::chrono::steady_clock::time_point begin(std::chrono::steady_clock::now());
+    std::chrono::steady_clock::time_point last(begin);
+    uint64_t last_count(0);
+    bool running(true);
+    while(running) {
+        {
+            unique_lock< mutex > progress_lock(progress_mutex);
+            running = !progress_stopped.wait_for(progress_lock, std::chrono::seconds(progress_interval), [this]() { return !progressing; });
+        }
+        const std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+        try {
+            write_progress(
+                std::chrono::duration< double >(now - begin).count(),
+                std::chrono::duration< double >(now - last).count(),
+                last_count);
+
+        } catch(exception& error) {
+            /*  progress reporting is advisory, a failure to write it must not terminate the job
+                so report it once and stop sampling while transcoding carries on */
+            cerr << "progress report disabled: " << error.what() << endl;
+            running = false;
+        }
+        last = now;
+    }
+};
+void Transcode::write_progress(const double& elapsed, const double& interval, uint64_t& last_count) const {
+    Document progress(kObjectType);
+    uint64_t progress_count(0);
+    uint64_t progress_pf_count(0);
+    uint64_t decoded_count(0);
+    vector< uint64_t > unclassified_count_by_classifier(transcoding_decoder->classifier_cardinality(), 0);
+
+    Value thread_array(kArrayType);
+    for(const auto& transcoding_thread : transcoding_thread_by_index) {
+        const TranscodingProgress& published(transcoding_thread.progress);
+        const uint64_t thread_count(published.count.load(std::memory_order_relaxed));
+        const double idle(double(published.idle_microseconds.load(std::memory_order_relaxed)) / 1000000.0);
+        progress_count += thread_count;
+        progress_pf_count += published.pf_count.load(std::memory_order_relaxed);
+        decoded_count += published.decoded_count.load(std::memory_order_relaxed);
+        for(size_t i(0); i < unclassified_count_by_classifier.size(); ++i) {
+            unclassified_count_by_classifier[i] += published.unclassified_count_by_classifier[i].load(std::memory_order_relaxed);
+        }
+
+        Value element(kObjectType);
+        encode_key_value("index", transcoding_thread.index, element, progress);
+        encode_key_value("count", thread_count, element, progress);
+        encode_key_value("idle seconds", idle, element, progress);
+        if(elapsed > 0) {
+            encode_key_value("idle fraction", min(idle / elapsed, 1.0), element, progress);
+        }
+        thread_array.PushBack(element.Move(), progress.GetAllocator());
+    }
+
+    encode_key_value("elapsed seconds", elapsed, progress, progress);
+    encode_key_value("count", progress_count, progress, progress);
+    encode_key_value("pf count", progress_pf_count, progress, progress);
+    if(elapsed > 0) {
+        encode_key_value("reads per second", double(progress_count) / elapsed, progress, progress);
+    }
+    if(interval > 0) {
+        encode_key_value("interval reads per second", double(progress_count - last_count) / interval, progress, progress);
+    }
+    last_count = progress_count;
+    progress.AddMember("decoding thread", thread_array.Move(), progress.GetAllocator());
+
+    Value decoder(kObjectType);
+    encode_key_value("count", decoded_count, decoder, progress);
+    transcoding_decoder->encode_progress(unclassified_count_by_classifier, decoded_count, decoder, progress);
+    progress.AddMember("decoder", decoder.Move(), progress.GetAllocator());
+
+    Value input_feed_array(kArrayType);
+    for(const auto feed : input_feed_by_index) {
+        Value element(kObjectType);
+        encode_key_value("index", feed->index, element, progress);
+        encode_key_value("url", feed->url, element, progress);
+        encode_key_value("occupancy", feed->occupancy(), element, progress);
+        input_feed_array.PushBack(element.Move(), progress.GetAllocator());
+    }
+    progress.AddMember("input feed", input_feed_array.Move(), progress.GetAllocator());
+
+    Value output_feed_array(kArrayType);
+    for(const auto feed : output_feed_by_index) {
+        Value element(kObjectType);
+        encode_key_value("index", feed->index, element, progress);
+        encode_key_value("url", feed->url, element, progress);
+        encode_key_value("occupancy", feed->occupancy(), element, progress);
+        output_feed_array.PushBack(element.Move(), progress.GetAllocator());
+    }
+    progress.AddMember("output feed", output_feed_array.Move(), progress.GetAllocator());
+
+    /* write to a temporary file and rename it so a reader never sees a partial snapshot */
+    URL progress_url(decode_value_by_key< URL >("progress url", ontology));
+    if(progress_url.is_stdout()) {
+        print_json(progress, cout, float_precision());
+
+    } else if(progress_url.is_stderr()) {
+        print_json(progress, cerr, float_precision());
+
+    } else if(!progress_url.is_dev_null()) {
+        const string path(progress_url.path());
+        const string staging(path + ".tmp");
+        print_json(progress, staging.c_str(), float_precision());
+        if(rename(staging.c_str(), path.c_str()) != 0) {
+            throw IOError("can not write progress report to " + path);
+        }
+    }
 };
 void Transcode::stop() {
     /*
@@ -1802,12 +2109,23 @@ void Transcode::stop() {
     for(auto feed : output_feed_by_index) {
         feed->stop();
     }
+
+    /*  the decoding threads are done so input feeds waiting for
+        records to be released from the batch ring can stop */
+    halt_input();
     for(auto feed : input_feed_by_index) {
         feed->join();
     }
     for(auto feed : output_feed_by_index) {
         feed->join();
     }
+
+    /* raise the first error a decoding thread failed with */
+    for(auto& transcoding_thread : transcoding_thread_by_index) {
+        if(transcoding_thread.failure) {
+            std::rethrow_exception(transcoding_thread.failure);
+        }
+    }
 };
 void Transcode::finalize() {
     Job::finalize();
@@ -1837,6 +2155,10 @@ void Transcode::finalize() {
         transcoding_decoder->encode(report, report);
     }
 
+    #if defined(PHENIQS_STAGE_PROFILE)
+    encode_profile(report, report);
+    #endif
+
     if(true) {
         /* add read group metadata to report */
         vector< HeadRGAtom > rg_by_index;
@@ -1861,6 +2183,81 @@ void Transcode::finalize() {
     clean_json_value(report, report);
     sort_json_value(report, report);
 };
+#if defined(PHENIQS_STAGE_PROFILE)
+static Value encode_stage_profile(const StageProfile& profile, const double& cycles_per_second, Document& document) {
+    Value array(kArrayType);
+    uint64_t staged_cycles(0);
+    for(size_t i(0); i < PROFILE_STAGE_CARDINALITY; ++i) {
+        Value element(kObjectType);
+        encode_key_value("stage", to_string(static_cast< ProfileStage >(i)), element, document);
+        encode_key_value("count", profile.count_by_stage[i], element, document);
+        encode_key_value("seconds", double(profile.cycles_by_stage[i]) / cycles_per_second, element, document);
+        encode_key_value("wait seconds", double(profile.wait_cycles_by_stage[i]) / cycles_per_second, element, document);
+        if(profile.total_cycles > 0) {
+            encode_key_value("fraction", double(profile.cycles_by_stage[i]) / double(profile.total_cycles), element, document);
+            encode_key_value("wait fraction", double(profile.wait_cycles_by_stage[i]) / double(profile.total_cycles), element, document);
+        }
+        array.PushBack(element.Move(), document.GetAllocator());
+        staged_cycles += profile.cycles_by_stage[i];
+    }
+
+    /* screening reads and recycling the batch are not attributed to any stage */
+    Value element(kObjectType);
+    const uint64_t other_cycles(profile.total_cycles > staged_cycles ? profile.total_cycles - staged_cycles : 0);
+    encode_key_value("stage", "other", element, document);
+    encode_key_value("seconds", double(other_cycles) / cycles_per_second, element, document);
+    if(profile.total_cycles > 0) {
+        encode_key_value("fraction", double(other_cycles) / double(profile.total_cycles), element, document);
+    }
+    array.PushBack(element.Move(), document.GetAllocator());
+    return array;
+};
+static Value encode_feed_profile(const list< Feed* >& feed_by_index, const double& cycles_per_second, Document& document) {
+    Value array(kArrayType);
+    for(const auto feed : feed_by_index) {
+        Value element(kObjectType);
+        encode_key_value("index", feed->index, element, document);
+        encode_key_value("url", feed->url, element, document);
+        encode_key_value("pull wait seconds", double(feed->pull_wait_cycles.load()) / cycles_per_second, element, document);
+        encode_key_value("push wait seconds", double(feed->push_wait_cycles.load()) / cycles_per_second, element, document);
+        array.PushBack(element.Move(), document.GetAllocator());
+    }
+    return array;
+};
+void Transcode::encode_profile(Value& container, Document& document) const {
+    /* the cycle counter rate is measured against the steady clock over the entire run */
+    const double elapsed(std::chrono::duration< double >(profile_end - profile_begin).count());
+    if(elapsed > 0 && profile_end_cycles > profile_begin_cycles) {
+        const double cycles_per_second(double(profile_end_cycles - profile_begin_cycles) / elapsed);
+        Value element(kObjectType);
+        encode_key_value("elapsed seconds", elapsed, element, document);
+        encode_key_value("cycles per second", cycles_per_second, element, document);
+
+        StageProfile total;
+        Value thread_array(kArrayType);
+        for(const auto& transcoding_thread : transcoding_thread_by_index) {
+            Value thread_element(kObjectType);
+            encode_key_value("index", transcoding_thread.index, thread_element, document);
+            encode_key_value("seconds", double(transcoding_thread.profile.total_cycles) / cycles_per_second, thread_element, document);
+            Value stage_array(encode_stage_profile(transcoding_thread.profile, cycles_per_second, document));
+            thread_element.AddMember("stage", stage_array.Move(), document.GetAllocator());
+            thread_array.PushBack(thread_element.Move(), document.GetAllocator());
+            total += transcoding_thread.profile;
+        }
+        Value stage_array(encode_stage_profile(total, cycles_per_second, document));
+        element.AddMember("stage", stage_array.Move(), document.GetAllocator());
+        element.AddMember("decoding thread", thread_array.Move(), document.GetAllocator());
+
+        Value input_feed_array(encode_feed_profile(input_feed_by_index, cycles_per_second, document));
+        element.AddMember("input feed", input_feed_array.Move(), document.GetAllocator());
+        Value output_feed_array(encode_feed_profile(output_feed_by_index, cycles_per_second, document));
+        element.AddMember("output feed", output_feed_array.Move(), document.GetAllocator());
+
+        container.RemoveMember("stage profile");
+        container.AddMember("stage profile", element.Move(), document.GetAllocator());
+    }
+};
+#endif
 void Transcode::apply_interactive_ontology(Document& document) const {
     Document adjusted;
     adjusted.CopyFrom(interactive, adjusted.GetAllocator());
@@ -2008,6 +2405,9 @@ void Transcode::print_global_instruction(ostream& o) const {
     int32_t decoding_threads(decode_value_by_key< int32_t >("decoding threads", ontology));
     o << "    Decoding threads                            " << to_string(decoding_threads) << endl;
 
+    int32_t decoding_batch_size(decode_value_by_key< int32_t >("decoding batch size", ontology));
+    o << "    Decoding batch size                         " << to_string(decoding_batch_size) << endl;
+
     int32_t htslib_threads(decode_value_by_key< int32_t >("htslib threads", ontology));
     o << "    HTSLib threads                              " << to_string(htslib_threads) << endl;
     o << endl;
@@ -2115,6 +2515,31 @@ void Transcode::print_codec_instruction(const Value& value, const bool& plural,
 
             double confidence_threshold(decode_value_by_key< double >("confidence threshold", value));
             o << "    Confidence threshold                        " << confidence_threshold << endl;
+
+            bool log_space(decode_value_by_key< bool >("log space", value));
+            if(log_space) {
+                o << "    Log space scoring                           " << "enabled" << endl;
+            }
+
+            bool cache(decode_value_by_key< bool >("cache", value));
+            if(cache) {
+                uint64_t cache_capacity(decode_value_by_key< uint64_t >("cache capacity", value));
+                o << "    Decoding cache capacity                     " << cache_capacity << endl;
+
+                vector< uint8_t > cache_quality_bins(decode_value_by_key< vector< uint8_t > >("cache quality bins", value));
+                o << "    Decoding cache quality bins                ";
+                for(auto& element : cache_quality_bins) { o << " " << int32_t(element); }
+                o << endl;
+            }
+
+            bool pruning(decode_value_by_key< bool >("pruning", value));
+            if(pruning) {
+                int32_t pruning_distance(decode_value_by_key< int32_t >("pruning distance", value));
+                o << "    Pruning distance                            " << pruning_distance << endl;
+
+                double pruning_tolerance(decode_value_by_key< double >("pruning tolerance", value));
+                o << "    Pruning tolerance                           " << pruning_tolerance << endl;
+            }
         }
 
         int32_t segment_cardinality(decode_value_by_key< int32_t >("segment cardinality", value));
@@ -2290,16 +2715,23 @@ TranscodingThread::TranscodingThread(Transcode& job, const int32_t& index) try :
     leading_segment_index(decode_value_by_key< int32_t >("leading segment index", job.ontology)),
     input_segment_cardinality(decode_value_by_key< int32_t >("input segment cardinality", job.ontology)),
     output_segment_cardinality(decode_value_by_key< int32_t >("output segment cardinality", job.ontology)),
-    input(input_segment_cardinality, platform, leading_segment_index),
+    decoding_batch_size(decode_value_by_key< int32_t >("decoding batch size", job.ontology)),
     output(output_segment_cardinality, platform, leading_segment_index),
-    multiplexer(*job.multiplexer),
-    transcoding_decoder(job.ontology),
+    multiplexer(*job.multiplexer, index),
+    transcoding_decoder(*job.transcoding_decoder),
+    input_count(0),
+    input_pf_count(0),
+    progress(transcoding_decoder.classifier_cardinality()),
     job(job),
     filter_incoming_qc_fail(decode_value_by_key< bool >("filter incoming qc fail", job.ontology)),
     min_input_length(decode_value_by_key< vector < int32_t > >("min input length", job.ontology)),
     template_rule(decode_value_by_key< Rule >("transform", job.ontology["template"])) {
 
-    input.clear();
+    for(int32_t i(0); i < decoding_batch_size; ++i) {
+        input_batch.emplace_back(input_segment_cardinality, platform, leading_segment_index);
+        input_batch.back().clear();
+    }
+    accepted_batch.reserve(decoding_batch_size);
     output.clear();
 
     } catch(Error& error) {
@@ -2309,5 +2741,4 @@ TranscodingThread::TranscodingThread(Transcode& job, const int32_t& index) try :
 
 void TranscodingThread::finalize() {
     transcoding_decoder.finalize();
-    multiplexer.finalize();
 };
@@ -37,9 +37,30 @@
 class Transcode;
 class TranscodingThread;
 
+/*  Counters a transcoding thread publishes once per batch so the progress report
+    can sample them while the thread is running without touching the hot path */
+class TranscodingProgress {
+    public:
+        TranscodingProgress(TranscodingProgress const &) = delete;
+        void operator=(TranscodingProgress const &) = delete;
+        atomic< uint64_t > count;
+        atomic< uint64_t > pf_count;
+        atomic< uint64_t > decoded_count;
+        atomic< uint64_t > idle_microseconds;
+        vector< atomic< uint64_t > > unclassified_count_by_classifier;
+        TranscodingProgress(const size_t& classifier_cardinality) :
+            count(0),
+            pf_count(0),
+            decoded_count(0),
+            idle_microseconds(0),
+            unclassified_count_by_classifier(classifier_cardinality) {
+        };
+};
+
 class TranscodingDecoder {
     public:
         TranscodingDecoder(const Value& ontology);
+        TranscodingDecoder(const TranscodingDecoder& other);
         ~TranscodingDecoder();
 
         uint64_t count;
@@ -48,6 +69,17 @@ class TranscodingDecoder {
         Classifier< Barcode >* sample_classifier;
         vector< Classifier< Barcode >* > molecular_classifier_array;
         vector< Classifier< Barcode >* > cellular_classifier_array;
+        inline void prepare(const vector< Read* >& batch) {
+            if(sample_classifier != NULL) {
+                sample_classifier->prepare(batch);
+            }
+            for(auto& classifier : molecular_classifier_array) {
+                classifier->prepare(batch);
+            }
+            for(auto& classifier : cellular_classifier_array) {
+                classifier->prepare(batch);
+            }
+        };
         inline void classify(const Read& input, Read& output) {
             if(sample_classifier != NULL) {
                 sample_classifier->classify(input, output);
@@ -63,11 +95,30 @@ class TranscodingDecoder {
                 ++pf_count;
             }
         };
+        inline size_t classifier_cardinality() const {
+            return (sample_classifier != NULL ? 1 : 0) + molecular_classifier_array.size() + cellular_classifier_array.size();
+        };
+        inline void publish(TranscodingProgress& progress) const {
+            /* classifiers are published in the order they classify a read */
+            size_t index(0);
+            progress.decoded_count.store(count, std::memory_order_relaxed);
+            if(sample_classifier != NULL) {
+                progress.unclassified_count_by_classifier[index++].store(sample_classifier->unclassified_count(), std::memory_order_relaxed);
+            }
+            for(auto& classifier : molecular_classifier_array) {
+                progress.unclassified_count_by_classifier[index++].store(classifier->unclassified_count(), std::memory_order_relaxed);
+            }
+            for(auto& classifier : cellular_classifier_array) {
+                progress.unclassified_count_by_classifier[index++].store(classifier->unclassified_count(), std::memory_order_relaxed);
+            }
+        };
         void collect(const TranscodingDecoder& other);
         void finalize();
         void encode(Value& container, Document& document) const;
+        void encode_progress(const vector< uint64_t >& unclassified_count_by_classifier, const uint64_t& decoded_count, Value& container, Document& document) const;
 
     private:
+        Classifier< Barcode >* copy_classifier(const Classifier< Barcode >& other) const;
         void load_sample_decoding(const Value& ontology);
         void load_sample_decoder(const Value& value);
         void load_molecular_decoding(const Value& ontology);
@@ -90,7 +141,7 @@ class Transcode : public Job {
         inline bool is_sense_input_layout() const {
             return decode_value_by_key< bool >("sense input layout", interactive);
         };
-        bool pull(Read& read);
+        int32_t pull_batch(list< Read >& batch);
         void assemble() override;
         void compile() override;
         void describe() const override;
@@ -109,15 +160,27 @@ class Transcode : public Job {
         void write_result() const override;
 
     private:
-        bool end_of_input;
         int32_t decoded_nucleotide_cardinality;
         htsThreadPool thread_pool;
         list< Feed* > input_feed_by_index;
         list< Feed* > output_feed_by_index;
         vector< Feed* > input_feed_by_segment;
+        vector< int32_t > input_record_by_segment;
+        atomic< int64_t > next_input_ordinal;
         Multiplexer* multiplexer;
         TranscodingDecoder* transcoding_decoder;
         list< TranscodingThread > transcoding_thread_by_index;
+        thread progress_thread;
+        mutex progress_mutex;
+        condition_variable progress_stopped;
+        bool progressing;
+        #if defined(PHENIQS_STAGE_PROFILE)
+        uint64_t profile_begin_cycles;
+        uint64_t profile_end_cycles;
+        std::chrono::steady_clock::time_point profile_begin;
+        std::chrono::steady_clock::time_point profile_end;
+        void encode_profile(Value& container, Document& document) const;
+        #endif
 
         void compile_PG();
         void compile_explicit_input();
@@ -150,6 +213,12 @@ class Transcode : public Job {
         void load_decoding();
         void load_input();
         void load_output();
+        void halt_input();
+        void throw_mismatched_input(const int64_t& ordinal, const size_t& segment_index);
+        void start_progress();
+        void stop_progress();
+        void run_progress();
+        void write_progress(const double& elapsed, const double& interval, uint64_t& last_count) const;
 
         void apply_prior_adjustment(Document& document) const;
         void print_global_instruction(ostream& o) const;
@@ -175,10 +244,20 @@ class TranscodingThread {
         const int32_t leading_segment_index;
         const int32_t input_segment_cardinality;
         const int32_t output_segment_cardinality;
-        Read input;
+        const int32_t decoding_batch_size;
+        list< Read > input_batch;
+        vector< Read* > accepted_batch;
         Read output;
         Multiplexer multiplexer;
         TranscodingDecoder transcoding_decoder;
+        uint64_t input_count;
+        uint64_t input_pf_count;
+        TranscodingProgress progress;
+        #if defined(PHENIQS_STAGE_PROFILE)
+        StageProfile profile;
+        #endif
+        /* an error raised on the thread is raised again by the job once the feeds are stopped */
+        exception_ptr failure;
         TranscodingThread(Transcode& job, const int32_t& index);
         void start() {
             thread_instance = thread(&TranscodingThread::run, this);
@@ -200,28 +279,112 @@ class TranscodingThread {
         };
 
         void run() {
-            while(job.pull(input)) {
-                input.validate();
-                if((!filter_incoming_qc_fail || !input.qcfail()) && !filter_input(input)) {
-                    /* populate output qc_fail and qname flag from the input */
-                    const bool qcfail = input.qcfail();
-                    for(auto& segment : output) {
-                        ks_put_string(input.name(), segment.name);
-                        segment.set_qcfail(qcfail);
-
-                        #if defined(PHENIQS_ILLUMINA_CONTROL_NUMBER)
-                        segment.auxiliary.illumina_control_number = source.auxiliary().illumina_control_number;
-                        #endif
-                    }
+            try {
+                transcode_input();
 
-                    transcoding_decoder.classify(input, output);
-                    template_rule.apply(input, output);
-                    output.flush();
-                    multiplexer.push(output);
+            } catch(...) {
+                /* the other decoding threads see the input end and the job raises the error */
+                failure = std::current_exception();
+                job.halt_input();
+            }
+        };
+        void transcode_input() {
+            #if defined(PHENIQS_STAGE_PROFILE)
+            const uint64_t begin(read_cycle_counter());
+            #endif
+
+            /*  claim a batch of reads from the input feeds at once and decode them,
+                a short batch means the input is exhausted */
+            int32_t pulled(decoding_batch_size);
+            while(pulled == decoding_batch_size) {
+                {
+                    PHENIQS_PROFILE_STAGE(profile, ProfileStage::PULL);
+                    pulled = job.pull_batch(input_batch);
+                }
+
+                /*  screen the batch first so the decoders can extract the observations
+                    of every accepted read in one pass before any of them is classified */
+                accepted_batch.clear();
+                int32_t remaining(pulled);
+                for(auto& input : input_batch) {
+                    if(remaining > 0) {
+                        if(accept(input)) {
+                            input.observation_index = static_cast< int32_t >(accepted_batch.size());
+                            accepted_batch.push_back(&input);
+                        }
+                        --remaining;
+                    } else {
+                        break;
+                    }
+                }
+                {
+                    PHENIQS_PROFILE_STAGE(profile, ProfileStage::CLASSIFY);
+                    transcoding_decoder.prepare(accepted_batch);
+                }
+                for(auto input : accepted_batch) {
+                    transcode(*input);
                 }
-                input.clear();
-                output.clear();
+                for(auto& input : input_batch) {
+                    input.clear();
+                }
+                publish_progress();
+            }
+
+            /* hand records still staged for output to the feeds and accumulate the remaining quality control */
+            {
+                PHENIQS_PROFILE_STAGE(profile, ProfileStage::PUSH);
+                multiplexer.flush();
+                multiplexer.accumulate();
+            }
+
+            #if defined(PHENIQS_STAGE_PROFILE)
+            profile.total_cycles = read_cycle_counter() - begin;
+            #endif
+        };
+        inline void publish_progress() {
+            progress.count.store(input_count, std::memory_order_relaxed);
+            progress.pf_count.store(input_pf_count, std::memory_order_relaxed);
+            progress.idle_microseconds.store(idle_wait_microseconds, std::memory_order_relaxed);
+            transcoding_decoder.publish(progress);
+        };
+        /* returning true means read should be transcoded */
+        inline bool accept(Read& input) {
+            ++input_count;
+            if(!input.qcfail()) {
+                ++input_pf_count;
+            }
+            input.validate();
+            return (!filter_incoming_qc_fail || !input.qcfail()) && !filter_input(input);
+        };
+        inline void transcode(Read& input) {
+            /* populate output qc_fail and qname flag from the input */
+            const bool qcfail = input.qcfail();
+            for(auto& segment : output) {
+                ks_put_string(input.name(), segment.name);
+                segment.set_qcfail(qcfail);
+
+                #if defined(PHENIQS_ILLUMINA_CONTROL_NUMBER)
+                segment.auxiliary.illumina_control_number = source.auxiliary().illumina_control_number;
+                #endif
+            }
+
+            {
+                PHENIQS_PROFILE_STAGE(profile, ProfileStage::CLASSIFY);
+                transcoding_decoder.classify(input, output);
+            }
+            {
+                PHENIQS_PROFILE_STAGE(profile, ProfileStage::APPLY);
+                template_rule.apply(input, output);
+            }
+            {
+                PHENIQS_PROFILE_STAGE(profile, ProfileStage::FLUSH);
+                output.flush();
+            }
+            {
+                PHENIQS_PROFILE_STAGE(profile, ProfileStage::PUSH);
+                multiplexer.push(output);
             }
+            output.clear();
         };
 
     private:
@@ -141,31 +141,77 @@ class Rule {
         };
         inline void apply(const Read& source, Observation& target) const {
             for(auto& transform : transform_array ) {
-                const Segment& from = source[transform.input_segment_index];
-                ObservedSequence& to = target[transform.output_segment_index];
-                const int32_t start(transform.absolute_start(from.length));
-                const int32_t end(transform.absolute_end(from.length));
-                const int32_t size(end - start);
-                if(size > 0) {
-                    to.increase_by_size(size);
-                    switch (transform.left) {
-                        case LeftTokenOperator::NONE: {
-                            memcpy(to.code + to.length, from.code + start, size);
-                            memcpy(to.quality + to.length, from.quality + start, size);
-                            break;
-                        };
-                        case LeftTokenOperator::REVERSE_COMPLEMENT: {
-                            for(int32_t i(0); i < size; ++i) {
-                                to.code[to.length + i] = BamToReverseComplementBam[from.code[end - i - 1]];
-                                to.quality[to.length + i] = from.quality[end - i - 1];
-                            }
-                            break;
-                        };
+                append(transform, source[transform.input_segment_index], target[transform.output_segment_index]);
+            }
+        };
+        inline void apply(const vector< Read* >& source, ObservationBatch& target) const {
+            const size_t batch_size(source.size());
+            target.reset(batch_size);
+
+            /* size every observation segment first so the planes are strided once for the whole batch */
+            for(size_t index(0); index < batch_size; ++index) {
+                const Read& read(*source[index]);
+                target.set_source(index, &read);
+                for(auto& transform : transform_array) {
+                    const int32_t length(read[transform.input_segment_index].length);
+                    const int32_t size(transform.absolute_end(length) - transform.absolute_start(length));
+                    if(size > 0) {
+                        target.length(transform.output_segment_index, index) += size;
+                    }
+                }
+            }
+            target.stride_to_length();
+
+            /*  copy one transform at a time over the batch so the target rows are written sequentially,
+                code and quality of a segment share an allocation so one prefetch brings both closer */
+            for(auto& transform : transform_array) {
+                for(size_t index(0); index < batch_size; ++index) {
+                    if(index + 1 < batch_size) {
+                        const Segment& next = (*source[index + 1])[transform.input_segment_index];
+                        __builtin_prefetch(next.code + transform.absolute_start(next.length));
+                    }
+                    const Segment& from = (*source[index])[transform.input_segment_index];
+                    const int32_t start(transform.absolute_start(from.length));
+                    const int32_t end(transform.absolute_end(from.length));
+                    const int32_t size(end - start);
+                    if(size > 0) {
+                        int32_t& length(target.length(transform.output_segment_index, index));
+                        copy(transform, from, start, end, target.code(transform.output_segment_index, index) + length, target.quality(transform.output_segment_index, index) + length);
+                        length += size;
                     }
-                    to.length += size;
-                    to.terminate();
                 }
             }
+            target.terminate();
+        };
+
+    private:
+        static inline void append(const Transform& transform, const Segment& from, ObservedSequence& to) {
+            const int32_t start(transform.absolute_start(from.length));
+            const int32_t end(transform.absolute_end(from.length));
+            const int32_t size(end - start);
+            if(size > 0) {
+                to.increase_by_size(size);
+                copy(transform, from, start, end, to.code + to.length, to.quality + to.length);
+                to.length += size;
+                to.terminate();
+            }
+        };
+        static inline void copy(const Transform& transform, const Segment& from, const int32_t& start, const int32_t& end, uint8_t* code, uint8_t* quality) {
+            const int32_t size(end - start);
+            switch (transform.left) {
+                case LeftTokenOperator::NONE: {
+                    memcpy(code, from.code + start, size);
+                    memcpy(quality, from.quality + start, size);
+                    break;
+                };
+                case LeftTokenOperator::REVERSE_COMPLEMENT: {
+                    for(int32_t i(0); i < size; ++i) {
+                        code[i] = BamToReverseComplementBam[from.code[end - i - 1]];
+                        quality[i] = from.quality[end - i - 1];
+                    }
+                    break;
+                };
+            }
         };
 };
 template<> Rule decode_value_by_key(const Value::Ch* key, const Value& container);